@@ -0,0 +1,99 @@
+#include <nitro.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+
+// the direct convolution the widgets used before nitro::blur()
+static std::vector<float> create_gaussian_kernel(int radius) {
+	std::vector<float> kernel(radius * 2 + 1);
+	const float sigma = radius / 3.f;
+	const float factor = 1.f / sqrtf(2.f * M_PI * sigma*sigma);
+	for (unsigned int i = 0; i < kernel.size(); ++i) {
+		const float x = (int)i - radius;
+		kernel[i] = factor * expf(-x*x/(2.f*sigma*sigma));
+	}
+	return kernel;
+}
+constexpr int clamp(int value, int min, int max) {
+	return value < min ? min : (max < value ? max : value);
+}
+static void convolution_blur(int radius, std::vector<unsigned char>& buffer, int w, int h) {
+	const std::vector<float> kernel = create_gaussian_kernel(radius);
+	std::vector<unsigned char> tmp(buffer.size());
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			float sum = 0.f;
+			for (int k = 0; k < radius * 2 + 1; ++k) {
+				const int kx = clamp(x + k - radius, 0, w - 1);
+				sum += buffer[y * w + kx] * kernel[k];
+			}
+			tmp[y * w + x] = sum + 0.5f;
+		}
+	}
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			float sum = 0.f;
+			for (int k = 0; k < radius * 2 + 1; ++k) {
+				const int ky = clamp(y + k - radius, 0, h - 1);
+				sum += tmp[ky * w + x] * kernel[k];
+			}
+			buffer[y * w + x] = sum + 0.5f;
+		}
+	}
+}
+
+// white rectangles on black, like the corner masks of the widgets
+static std::vector<unsigned char> create_image(int size) {
+	std::vector<unsigned char> image(size * size);
+	for (int i = 0; i < 16; ++i) {
+		const int x0 = rand() % size;
+		const int y0 = rand() % size;
+		const int x1 = std::min(size, x0 + rand() % (size / 2) + 1);
+		const int y1 = std::min(size, y0 + rand() % (size / 2) + 1);
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				image[y * size + x] = 255;
+			}
+		}
+	}
+	return image;
+}
+
+template <class F> static double measure(int repetitions, F&& f) {
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < repetitions; ++i) {
+		f();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repetitions;
+}
+
+int main() {
+	srand(1);
+	const int sizes[] = {128, 512, 1024};
+	const int radii[] = {3, 10, 30, 90};
+	printf("%6s %6s %12s %12s %8s\n", "size", "radius", "convolution", "nitro::blur", "maxdiff");
+	for (int size: sizes) {
+		const std::vector<unsigned char> image = create_image(size);
+		for (int radius: radii) {
+			std::vector<unsigned char> expected = image;
+			std::vector<unsigned char> actual = image;
+			// the slow cases run once
+			const int repetitions = std::max(1, 64 * 64 * 64 / (size * size * radius / 64 + 1));
+			const double convolution_time = measure(repetitions, [&] {
+				expected = image;
+				convolution_blur(radius, expected, size, size);
+			});
+			const double blur_time = measure(repetitions * 8, [&] {
+				actual = image;
+				nitro::blur(actual.data(), size, size, radius);
+			});
+			int maxdiff = 0;
+			for (std::size_t i = 0; i < image.size(); ++i) {
+				maxdiff = std::max(maxdiff, std::abs(expected[i] - actual[i]));
+			}
+			printf("%6d %6d %9.3f ms %9.3f ms %8d\n", size, radius, convolution_time, blur_time, maxdiff);
+		}
+	}
+}
@@ -0,0 +1,130 @@
+#include <nitro.hpp>
+#include <epoxy/egl.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <algorithm>
+
+using namespace nitro;
+
+static constexpr int SIZE = 256;
+static constexpr int CANVASES = 50;
+static Texture mask_texture;
+
+// overlapping fills of random colors and masks that cut through them, the same ones for every seed
+// the edges are on whole pixels, so that no pixel center lies on an edge the rasterizer could assign to both quads
+static void fill_canvas(Canvas& canvas, unsigned int seed, int fills, int masks) {
+	std::mt19937 random_engine(seed);
+	auto random = [&](int max) {
+		return static_cast<float>(std::uniform_int_distribution<int>(0, max - 1)(random_engine));
+	};
+	canvas.clear();
+	for (int i = 0; i < fills; ++i) {
+		const float x0 = random(SIZE * 3 / 4);
+		const float y0 = random(SIZE * 3 / 4);
+		canvas.set_color(x0, y0, x0 + 8.f + random(SIZE / 2), y0 + 8.f + random(SIZE / 2), Color(random(256) / 255.f, random(256) / 255.f, random(256) / 255.f));
+	}
+	for (int i = 0; i < masks; ++i) {
+		const float x0 = random(SIZE * 3 / 4);
+		const float y0 = random(SIZE * 3 / 4);
+		canvas.set_mask(x0, y0, x0 + 8.f + random(SIZE / 4), y0 + 8.f + random(SIZE / 4), mask_texture);
+	}
+}
+
+template <class F> static double measure(F&& f) {
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<unsigned char> read_pixels() {
+	std::vector<unsigned char> pixels(SIZE * SIZE * 4);
+	glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	return pixels;
+}
+
+static int get_maxdiff(const std::vector<unsigned char>& lhs, const std::vector<unsigned char>& rhs) {
+	int maxdiff = 0;
+	for (std::size_t i = 0; i < lhs.size(); ++i) {
+		maxdiff = std::max(maxdiff, std::abs(lhs[i] - rhs[i]));
+	}
+	return maxdiff;
+}
+
+// prepare() and draw() of the same canvases in both modes, drawn to the bound framebuffer and to one without a depth buffer
+static int run(gles2::FramebufferObject& framebuffer, int fills, int masks) {
+	const gles2::mat4 projection = gles2::project(SIZE, SIZE);
+	Canvas swept;
+	Canvas direct;
+	direct.set_direct(true);
+	double prepare_times[2] = {0.0, 0.0};
+	double draw_times[2] = {0.0, 0.0};
+	int maxdiff = 0;
+	for (int seed = 0; seed < CANVASES; ++seed) {
+		Canvas* canvases[2] = {&swept, &direct};
+		std::vector<unsigned char> pixels[2];
+		for (int i = 0; i < 2; ++i) {
+			fill_canvas(*canvases[i], seed, fills, masks);
+			prepare_times[i] += measure([&] {
+				canvases[i]->prepare();
+			});
+			glClear(GL_COLOR_BUFFER_BIT);
+			draw_times[i] += measure([&] {
+				canvases[i]->draw(projection);
+				glFinish();
+			});
+			pixels[i] = read_pixels();
+		}
+		maxdiff = std::max(maxdiff, get_maxdiff(pixels[0], pixels[1]));
+		// the direct canvas was prepared with a depth buffer, here it has to fall back to the sweep
+		framebuffer.use();
+		direct.draw(projection);
+		maxdiff = std::max(maxdiff, get_maxdiff(pixels[0], read_pixels()));
+		framebuffer.unbind();
+		glViewport(0, 0, SIZE, SIZE);
+	}
+	printf("%6d %6d %12.2f ms %12.2f ms %12.2f ms %12.2f ms %8d\n", fills, masks, prepare_times[0], prepare_times[1], draw_times[0], draw_times[1], maxdiff);
+	return maxdiff;
+}
+
+int main() {
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	eglInitialize(display, nullptr, nullptr);
+	const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE};
+	EGLConfig config;
+	EGLint configs;
+	eglChooseConfig(display, config_attributes, &config, 1, &configs);
+	const EGLint surface_attributes[] = {EGL_WIDTH, SIZE, EGL_HEIGHT, SIZE, EGL_NONE};
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+	const EGLint context_attributes[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (configs == 0 || !eglMakeCurrent(display, surface, surface, context)) {
+		fprintf(stderr, "could not create an EGL context with a depth buffer\n");
+		return 1;
+	}
+	unsigned char mask[16 * 16];
+	for (int i = 0; i < 16 * 16; ++i) {
+		mask[i] = (i % 16 + i / 16) * 8;
+	}
+	mask_texture = Texture::create_from_data(16, 16, 1, mask);
+	gles2::FramebufferObject framebuffer(SIZE, SIZE);
+	glViewport(0, 0, SIZE, SIZE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	const int fill_counts[] = {10, 40, 160, 640};
+	const int mask_counts[] = {4, 16, 64};
+	printf("%d canvases of %dx%d, times summed over all of them\n", CANVASES, SIZE, SIZE);
+	printf("%6s %6s %15s %15s %15s %15s %8s\n", "fills", "masks", "swept prepare", "direct prepare", "swept draw", "direct draw", "maxdiff");
+	int maxdiff = 0;
+	for (int fills: fill_counts) {
+		for (int masks: mask_counts) {
+			maxdiff = std::max(maxdiff, run(framebuffer, fills, masks));
+		}
+	}
+	// the parts of both modes are drawn from different quads, so they can round differently
+	if (maxdiff > 1) {
+		printf("the direct canvases differ from the swept ones\n");
+		return 1;
+	}
+}
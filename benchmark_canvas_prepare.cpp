@@ -0,0 +1,417 @@
+#include <nitro.hpp>
+#include <epoxy/egl.h>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <random>
+#include <queue>
+#include <set>
+#include <algorithm>
+
+using namespace nitro;
+
+// the sweep Canvas::prepare used before it was rewritten over flat arrays
+static std::vector<CanvasElement> reference_prepare(const std::vector<CanvasElement>& elements) {
+	class Event {
+	public:
+		enum class Type {
+			START,
+			END
+		};
+		Type type;
+		const CanvasElement* element;
+		float y;
+		constexpr Event(Type type, const CanvasElement* element): type(type), element(element), y(type == Type::START ? element->y0 : element->y1) {}
+		constexpr bool operator >(const Event& event) const {
+			return y != event.y ? y > event.y : element > event.element;
+		}
+	};
+
+	class ElementStack {
+		mutable float y0;
+		mutable std::set<const CanvasElement*> elements;
+	public:
+		float x0, x1;
+		ElementStack(const CanvasElement* element, float x0, float x1): y0(element->y0), x0(x0), x1(x1) {
+			elements.insert(element);
+		}
+		void insert(const CanvasElement* element) const {
+			elements.insert(element);
+		}
+		void remove(const CanvasElement* element) const {
+			elements.erase(element);
+		}
+		bool empty() const {
+			return elements.empty();
+		}
+		void get_element(float y1, std::vector<CanvasElement>& new_elements) const {
+			if (y0 == y1) {
+				return;
+			}
+			Color color;
+			Texture texture;
+			float alpha = 0.f;
+			Texture mask;
+			Texture inverted_mask;
+			Shape shape;
+			Shape inverted_shape;
+			for (const CanvasElement* element: elements) {
+				Quad quad(
+					(x0 - element->x0) / (element->x1 - element->x0),
+					(y0 - element->y0) / (element->y1 - element->y0),
+					(x1 - element->x0) / (element->x1 - element->x0),
+					(y1 - element->y0) / (element->y1 - element->y0)
+				);
+				if (element->texture) {
+					color = Color();
+					texture = element->texture * quad;
+					alpha = element->alpha;
+				}
+				else if (element->mask) {
+					mask = element->mask * quad;
+				}
+				else if (element->inverted_mask) {
+					inverted_mask = element->inverted_mask * quad;
+				}
+				else if (element->shape) {
+					shape = element->shape;
+				}
+				else if (element->inverted_shape) {
+					inverted_shape = element->inverted_shape;
+				}
+				else {
+					color = element->color;
+					texture = Texture();
+					alpha = 0.f;
+				}
+			}
+			if (color || (texture && alpha > 0.f)) {
+				new_elements.push_back(CanvasElement(x0, y0, x1, y1, color, texture, alpha, mask, inverted_mask, shape, inverted_shape));
+			}
+			y0 = y1;
+		}
+		ElementStack split_horizontally(float x) {
+			ElementStack left = *this;
+			left.x1 = x;
+			x0 = x;
+			return left;
+		}
+		bool operator <(const ElementStack& element_stack) const {
+			return x0 < element_stack.x0;
+		}
+	};
+
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+	for (const CanvasElement& element: elements) {
+		events.emplace(Event::Type::START, &element);
+		events.emplace(Event::Type::END, &element);
+	}
+
+	std::vector<CanvasElement> new_elements;
+	std::set<ElementStack> stacks;
+	while (!events.empty()) {
+		Event event = events.top();
+		events.pop();
+		const CanvasElement* element = event.element;
+		auto i0 = std::upper_bound(stacks.begin(), stacks.end(), element->x0, [](float x, const ElementStack& stack) {
+			return x < stack.x1;
+		});
+		auto i1 = std::lower_bound(stacks.begin(), stacks.end(), element->x1, [](const ElementStack& stack, float x) {
+			return stack.x0 < x;
+		});
+		if (event.type == Event::Type::START) {
+			float x = element->x0;
+			while (i0 != i1) {
+				if (i0->x0 < element->x0) {
+					ElementStack stack = *i0;
+					stacks.erase(i0);
+					ElementStack left = stack.split_horizontally(element->x0);
+					stacks.insert(left);
+					i0 = stacks.insert(stack).first;
+				}
+				if (element->x1 < i0->x1) {
+					ElementStack stack = *i0;
+					stacks.erase(i0);
+					ElementStack left = stack.split_horizontally(element->x1);
+					i0 = stacks.insert(left).first;
+					i1 = stacks.insert(stack).first;
+				}
+				if (x < i0->x0) {
+					stacks.insert(ElementStack(element, x, i0->x0));
+				}
+				i0->get_element(event.y, new_elements);
+				i0->insert(element);
+				x = i0->x1;
+				++i0;
+			}
+			if (x < element->x1) {
+				stacks.insert(ElementStack(element, x, element->x1));
+			}
+		}
+		else {
+			while (i0 != i1) {
+				i0->get_element(event.y, new_elements);
+				i0->remove(element);
+				if (i0->empty()) {
+					i0 = stacks.erase(i0);
+				}
+				else {
+					++i0;
+				}
+			}
+		}
+	}
+	assert(stacks.empty());
+	std::stable_sort(new_elements.begin(), new_elements.end(), [](const CanvasElement& lhs, const CanvasElement& rhs) {
+		const CanvasMaterial lhs_material {lhs.texture.texture.get(), lhs.mask.texture.get(), lhs.inverted_mask.texture.get(), lhs.shape, lhs.inverted_shape};
+		const CanvasMaterial rhs_material {rhs.texture.texture.get(), rhs.mask.texture.get(), rhs.inverted_mask.texture.get(), rhs.shape, rhs.inverted_shape};
+		return lhs_material < rhs_material;
+	});
+	return new_elements;
+}
+
+// the same elements the set_* methods of Canvas add
+class Input {
+	std::vector<CanvasElement> elements;
+public:
+	void set_color(float x0, float y0, float x1, float y1, const Color& color) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, color, Texture(), 0.f, Texture(), Texture());
+		}
+	}
+	void set_texture(float x0, float y0, float x1, float y1, const Texture& texture, float alpha) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, Color(), texture, alpha, Texture(), Texture());
+		}
+	}
+	void set_mask(float x0, float y0, float x1, float y1, const Texture& mask) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, mask, Texture());
+		}
+	}
+	void set_inverted_mask(float x0, float y0, float x1, float y1, const Texture& inverted_mask) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, Texture(), inverted_mask);
+		}
+	}
+	void set_shape(float x0, float y0, float x1, float y1, const Shape& shape) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, Texture(), Texture(), shape, Shape());
+		}
+	}
+	void set_inverted_shape(float x0, float y0, float x1, float y1, const Shape& inverted_shape) {
+		if (x0 < x1 && y0 < y1) {
+			elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, Texture(), Texture(), Shape(), inverted_shape);
+		}
+	}
+	const std::vector<CanvasElement>& get_elements() const {
+		return elements;
+	}
+	void apply(Canvas& canvas) const {
+		canvas.clear();
+		for (const CanvasElement& e: elements) {
+			if (e.texture) {
+				canvas.set_texture(e.x0, e.y0, e.x1, e.y1, e.texture, e.alpha);
+			}
+			else if (e.mask) {
+				canvas.set_mask(e.x0, e.y0, e.x1, e.y1, e.mask);
+			}
+			else if (e.inverted_mask) {
+				canvas.set_inverted_mask(e.x0, e.y0, e.x1, e.y1, e.inverted_mask);
+			}
+			else if (e.shape) {
+				canvas.set_shape(e.x0, e.y0, e.x1, e.y1, e.shape);
+			}
+			else if (e.inverted_shape) {
+				canvas.set_inverted_shape(e.x0, e.y0, e.x1, e.y1, e.inverted_shape);
+			}
+			else {
+				canvas.set_color(e.x0, e.y0, e.x1, e.y1, e.color);
+			}
+		}
+	}
+};
+
+static std::mt19937 random_engine(1);
+static Texture textures[3];
+
+static float random(float max) {
+	return std::uniform_real_distribution<float>(0.f, max)(random_engine);
+}
+static int random(int max) {
+	return std::uniform_int_distribution<int>(0, max - 1)(random_engine);
+}
+
+// elements of every kind on a coarse grid, so that many edges coincide
+static Input create_random_input(int count) {
+	Input input;
+	const float grid = 1 + random(8);
+	for (int i = 0; i < count; ++i) {
+		const float x0 = random(20) * grid / 4.f;
+		const float y0 = random(20) * grid / 4.f;
+		const float x1 = x0 + random(10) * grid / 4.f;
+		const float y1 = y0 + random(10) * grid / 4.f;
+		switch (random(7)) {
+		case 0: input.set_color(x0, y0, x1, y1, random(4) ? Color(random(3) / 2.f, 0.5f, 0.2f) * static_cast<float>(random(2)) : Color()); break;
+		case 1: input.set_texture(x0, y0, x1, y1, textures[random(3)], random(3) / 2.f); break;
+		case 2: input.set_mask(x0, y0, x1, y1, textures[random(3)]); break;
+		case 3: input.set_inverted_mask(x0, y0, x1, y1, textures[random(3)]); break;
+		case 4: input.set_shape(x0, y0, x1, y1, Shape(x0, y0, x1, y1, random(5), random(2))); break;
+		case 5: input.set_inverted_shape(x0, y0, x1, y1, Shape(x0, y0, x1, y1, random(5))); break;
+		default: input.set_color(x0, y0, x1, y1, Color(0.1f, 0.2f, 0.3f)); break;
+		}
+	}
+	return input;
+}
+
+// the corners of the texture fallback of RoundedRectangle and RoundedBorder
+static void add_corners(Input& input, float x0, float y0, float x3, float y3, float radius, const Texture& mask, bool inverted) {
+	const float x1 = x0 + radius;
+	const float y1 = y0 + radius;
+	const float x2 = x3 - radius;
+	const float y2 = y3 - radius;
+	Quad texcoord;
+	const float corners[4][4] = {{x2, y2, x3, y3}, {x0, y2, x1, y3}, {x0, y0, x1, y1}, {x2, y0, x3, y1}};
+	for (const auto& c: corners) {
+		if (inverted) {
+			input.set_inverted_mask(c[0], c[1], c[2], c[3], mask * texcoord);
+		}
+		else {
+			input.set_mask(c[0], c[1], c[2], c[3], mask * texcoord);
+		}
+		texcoord = texcoord.rotate();
+	}
+}
+
+// a card as the widgets draw it: a shadow, a rounded background, a border and a row of glyphs
+static void add_card(Input& input, float x, float y, float width, float height) {
+	const float radius = 4 + random(12);
+	const float blur_radius = 4 + random(16);
+	const Shape shadow(x, y + 2, x + width, y + height + 2, radius, blur_radius / 3.f);
+	input.set_color(x - blur_radius, y + 2 - blur_radius, x + width + blur_radius, y + height + 2 + blur_radius, Color(0.f, 0.f, 0.f) * 0.5f);
+	input.set_shape(x - blur_radius, y + 2 - blur_radius, x + width + blur_radius, y + radius + blur_radius, shadow);
+	input.set_shape(x - blur_radius, y + height - radius, x + width + blur_radius, y + height + 2 + blur_radius, shadow);
+	input.set_color(x + radius, y, x + width - radius, y + height, Color());
+	input.set_color(x, y + radius, x + width, y + height - radius, Color());
+	input.set_color(x, y, x + width, y + height, Color(0.9f, 0.9f, 0.9f));
+	add_corners(input, x, y, x + width, y + height, radius, textures[0], false);
+	const float border_width = 1 + random(3);
+	input.set_color(x, y, x + width, y + height, Color(0.2f, 0.4f, 0.8f));
+	add_corners(input, x, y, x + width, y + height, radius, textures[0], false);
+	input.set_color(x + radius, y + border_width, x + width - radius, y + height - border_width, Color());
+	input.set_color(x + border_width, y + radius, x + width - border_width, y + height - radius, Color());
+	add_corners(input, x + border_width, y + border_width, x + width - border_width, y + height - border_width, radius - border_width, textures[1], true);
+	for (float glyph_x = x + radius; glyph_x + 8 < x + width - radius; glyph_x += 7 + random(3)) {
+		input.set_texture(glyph_x, y + height / 2 - 6, glyph_x + 8, y + height / 2 + 6, textures[2], 1.f);
+	}
+}
+
+static Input create_widget_input(int cards) {
+	Input input;
+	for (int i = 0; i < cards; ++i) {
+		add_card(input, random(400.f), random(300.f), 60 + random(200.f), 30 + random(100.f));
+	}
+	return input;
+}
+
+static bool operator ==(const Quad& lhs, const Quad& rhs) {
+	const Quad::Data a = lhs.get_data();
+	const Quad::Data b = rhs.get_data();
+	return std::equal(a.data, a.data + 8, b.data);
+}
+static bool operator ==(const Texture& lhs, const Texture& rhs) {
+	return lhs.texture == rhs.texture && (!lhs || lhs.texcoord == rhs.texcoord);
+}
+static bool operator ==(const Shape& lhs, const Shape& rhs) {
+	return lhs.x0 == rhs.x0 && lhs.y0 == rhs.y0 && lhs.x1 == rhs.x1 && lhs.y1 == rhs.y1 && lhs.radius == rhs.radius && lhs.sigma == rhs.sigma;
+}
+static bool equal(const CanvasElement& lhs, const CanvasElement& rhs) {
+	return lhs.x0 == rhs.x0 && lhs.y0 == rhs.y0 && lhs.x1 == rhs.x1 && lhs.y1 == rhs.y1
+		&& lhs.color == rhs.color
+		&& lhs.texture == rhs.texture && lhs.alpha == rhs.alpha && lhs.mask == rhs.mask && lhs.inverted_mask == rhs.inverted_mask
+		&& lhs.shape == rhs.shape && lhs.inverted_shape == rhs.inverted_shape;
+}
+
+template <class F> static double measure(F&& f) {
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// runs both sweeps on the inputs, returns false if any output differs
+static bool run(const char* name, const std::vector<Input>& inputs) {
+	std::vector<std::vector<CanvasElement>> expected(inputs.size());
+	const double reference_time = measure([&] {
+		for (std::size_t i = 0; i < inputs.size(); ++i) {
+			expected[i] = reference_prepare(inputs[i].get_elements());
+		}
+	});
+	// both include building and uploading the vertices
+	Mesh mesh;
+	const double reference_upload_time = measure([&] {
+		for (const std::vector<CanvasElement>& elements: expected) {
+			mesh.clear();
+			for (const CanvasElement& element: elements) {
+				mesh.add(element);
+			}
+			mesh.prepare();
+		}
+	});
+	Canvas canvas;
+	std::size_t mismatches = 0;
+	double prepare_time = 0.0;
+	for (std::size_t i = 0; i < inputs.size(); ++i) {
+		inputs[i].apply(canvas);
+		prepare_time += measure([&] {
+			canvas.prepare();
+		});
+		const std::vector<CanvasElement>& actual = canvas.get_elements();
+		if (!std::equal(actual.begin(), actual.end(), expected[i].begin(), expected[i].end(), equal)) {
+			++mismatches;
+		}
+	}
+	printf("%-8s %6zu canvases  reference %8.2f ms  prepare() %8.2f ms  mismatches %zu\n", name, inputs.size(), reference_time + reference_upload_time, prepare_time, mismatches);
+	return mismatches == 0;
+}
+
+int main() {
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	eglInitialize(display, nullptr, nullptr);
+	const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE};
+	EGLConfig config;
+	EGLint configs;
+	eglChooseConfig(display, config_attributes, &config, 1, &configs);
+	const EGLint surface_attributes[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+	const EGLint context_attributes[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (!eglMakeCurrent(display, surface, surface, context)) {
+		fprintf(stderr, "could not create an EGL context\n");
+		return 1;
+	}
+	const unsigned char pixels[4] = {1, 2, 3, 4};
+	textures[0] = Texture::create_from_data(1, 1, 1, pixels);
+	textures[1] = Texture::create_from_data(1, 1, 1, pixels);
+	textures[2] = Texture::create_from_data(1, 1, 4, pixels);
+
+	bool identical = true;
+	std::vector<Input> inputs;
+	for (int i = 0; i < 2000; ++i) {
+		inputs.push_back(create_random_input(1 + random(12)));
+	}
+	identical &= run("small", inputs);
+	inputs.clear();
+	for (int i = 0; i < 1000; ++i) {
+		inputs.push_back(create_random_input(1 + random(150)));
+	}
+	identical &= run("random", inputs);
+	inputs.clear();
+	for (int i = 0; i < 200; ++i) {
+		inputs.push_back(create_widget_input(1 + random(8)));
+	}
+	identical &= run("widgets", inputs);
+	if (!identical) {
+		printf("the output differs from the reference\n");
+		return 1;
+	}
+}
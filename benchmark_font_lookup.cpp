@@ -0,0 +1,138 @@
+#include <nitro.hpp>
+#include <chrono>
+#include <cstdio>
+
+using namespace nitro;
+
+// the scan FontSet::get_font used to do for every character
+class FontScan {
+	FcPattern* pattern;
+	FcFontSet* font_set;
+	FcCharSet* char_set;
+public:
+	FontScan(const char* family, float size) {
+		FcResult result;
+		pattern = FcPatternCreate();
+		FcPatternAddString(pattern, FC_FAMILY, reinterpret_cast<const FcChar8*>(family));
+		FcPatternAddDouble(pattern, FC_PIXEL_SIZE, size);
+		FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+		FcDefaultSubstitute(pattern);
+		font_set = FcFontSort(nullptr, pattern, true, &char_set, &result);
+	}
+	~FontScan() {
+		FcCharSetDestroy(char_set);
+		FcFontSetDestroy(font_set);
+		FcPatternDestroy(pattern);
+	}
+	int find(uint32_t character) const {
+		int i = 0;
+		if (FcCharSetHasChar(char_set, character)) {
+			for (i = 0; i < font_set->nfont; ++i) {
+				FcCharSet* font_char_set;
+				FcPatternGetCharSet(font_set->fonts[i], FC_CHARSET, 0, &font_char_set);
+				if (FcCharSetHasChar(font_char_set, character)) {
+					break;
+				}
+			}
+		}
+		return i;
+	}
+};
+
+static const char32_t* const corpus[] = {
+	U"The quick brown fox jumps over the lazy dog",
+	U"Ünïcödé façade — naïve café, 42 €",
+	U"Ελληνικά: Η γρήγορη καφέ αλεπού",
+	U"Русский: Съешь же ещё этих мягких французских булок",
+	U"日本語: いろはにほへと ちりぬるを",
+	U"中文: 天地玄黄 宇宙洪荒",
+	U"한국어: 다람쥐 헌 쳇바퀴에 타고파",
+	U"العربية: نص حكيم له سر قاطع",
+	U"עברית: דג סקרן שט בים מאוכזב",
+	U"हिन्दी: ऋषियों को सताने वाले दुष्ट राक्षसों",
+	U"ไทย: เป็นมนุษย์สุดประเสริฐเลิศคุณค่า",
+	U"Emoji: 😀 🎉 🚀 👍🏽",
+};
+static constexpr int PASSES = 200;
+
+template <class F> static double measure(F&& f) {
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+	FontSet font_set("DejaVu Sans", 14.f);
+	FontScan font_scan("DejaVu Sans", 14.f);
+	std::size_t characters = 0;
+	for (const char32_t* line: corpus) {
+		characters += std::char_traits<char32_t>::length(line);
+	}
+
+	unsigned long checksum = 0;
+	const double scan_time = measure([&] {
+		for (int pass = 0; pass < PASSES; ++pass) {
+			for (const char32_t* line: corpus) {
+				for (const char32_t* c = line; *c; ++c) {
+					checksum += font_scan.find(*c);
+				}
+			}
+		}
+	});
+	// the first lookup of every character fills the table
+	const double first_time = measure([&] {
+		for (const char32_t* line: corpus) {
+			for (const char32_t* c = line; *c; ++c) {
+				checksum += reinterpret_cast<uintptr_t>(font_set.get_font(*c)) & 1;
+			}
+		}
+	});
+	const double lookup_time = measure([&] {
+		for (int pass = 0; pass < PASSES; ++pass) {
+			for (const char32_t* line: corpus) {
+				for (const char32_t* c = line; *c; ++c) {
+					checksum += reinterpret_cast<uintptr_t>(font_set.get_font(*c)) & 1;
+				}
+			}
+		}
+	});
+
+	// every pass appends a different number, so the shaped run cache does not hide the shaping
+	hb_buffer_t* buffer = hb_buffer_create();
+	std::u32string text;
+	const double shape_time = measure([&] {
+		for (int pass = 0; pass < PASSES; ++pass) {
+			for (const char32_t* line: corpus) {
+				text = line;
+				for (char c: std::to_string(pass)) {
+					text.push_back(c);
+				}
+				std::size_t run_start = 0;
+				Font* font = font_set.get_font(text[0]);
+				for (std::size_t i = 1; i <= text.size(); ++i) {
+					Font* next_font = i < text.size() ? font_set.get_font(text[i]) : nullptr;
+					if (next_font == font) {
+						continue;
+					}
+					const uint32_t* run = reinterpret_cast<const uint32_t*>(text.data()) + run_start;
+					const int length = i - run_start;
+					hb_buffer_clear_contents(buffer);
+					hb_buffer_add_codepoints(buffer, run, length, 0, length);
+					hb_buffer_guess_segment_properties(buffer);
+					checksum += font->shape(buffer, run, length).size();
+					run_start = i;
+					font = next_font;
+				}
+			}
+		}
+	});
+	hb_buffer_destroy(buffer);
+
+	const double lookups = static_cast<double>(characters) * PASSES;
+	printf("%zu characters in %zu lines, %d passes\n", characters, sizeof(corpus) / sizeof(*corpus), PASSES);
+	printf("linear scan:       %8.2f ms (%6.1f ns per character)\n", scan_time, scan_time * 1e6 / lookups);
+	printf("first lookups:     %8.2f ms\n", first_time);
+	printf("memoized lookups:  %8.2f ms (%6.1f ns per character)\n", lookup_time, lookup_time * 1e6 / lookups);
+	printf("itemize and shape: %8.2f ms (%6.1f ns per character)\n", shape_time, shape_time * 1e6 / lookups);
+	printf("checksum %lu\n", checksum);
+}
@@ -0,0 +1,304 @@
+/*
+
+Copyright (c) 2022, Elias Aebi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nitro.hpp"
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// three box blurs approximate a Gaussian, every box blur is a running sum and costs the same for any radius
+static void get_box_radii(float sigma, int radii[3]) {
+	const float ideal = sqrtf(4.f * sigma * sigma + 1.f);
+	int lower = ideal;
+	if (lower % 2 == 0) {
+		--lower;
+	}
+	const int upper = lower + 2;
+	const int m = roundf((12.f * sigma * sigma - 3 * lower * lower - 12 * lower - 9) / (-4.f * lower - 4.f));
+	for (int i = 0; i < 3; ++i) {
+		radii[i] = ((i < m ? lower : upper) - 1) / 2;
+	}
+}
+
+// images below this size are not worth splitting across threads
+static constexpr int PARALLEL_THRESHOLD = 256 * 256;
+
+// threads that are started with the first large blur and wait for work between calls
+class WorkerPool {
+	std::vector<std::thread> threads;
+	// only one caller at a time hands out work
+	std::mutex run_mutex;
+	std::mutex mutex;
+	std::condition_variable start_condition;
+	std::condition_variable done_condition;
+	const std::function<void(int, int)>* function;
+	int count;
+	int parts;
+	unsigned int generation;
+	int pending;
+	bool stopping;
+	void work(int index);
+public:
+	WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	~WorkerPool();
+	WorkerPool& operator =(const WorkerPool&) = delete;
+	int get_size() const;
+	// calls function(first, last) for parts consecutive ranges of [0, count), the first range on the calling thread
+	void run(int count, int parts, const std::function<void(int, int)>& function);
+};
+WorkerPool::WorkerPool(): function(nullptr), count(0), parts(0), generation(0), pending(0), stopping(false) {
+	const int size = std::thread::hardware_concurrency();
+	for (int i = 1; i < size; ++i) {
+		threads.emplace_back(&WorkerPool::work, this, i);
+	}
+}
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	start_condition.notify_all();
+	for (std::thread& thread: threads) {
+		thread.join();
+	}
+}
+void WorkerPool::work(int index) {
+	unsigned int last_generation = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		start_condition.wait(lock, [&] { return stopping || generation != last_generation; });
+		if (stopping) {
+			return;
+		}
+		last_generation = generation;
+		if (index >= parts) {
+			continue;
+		}
+		const int first = count * index / parts;
+		const int last = count * (index + 1) / parts;
+		lock.unlock();
+		(*function)(first, last);
+		lock.lock();
+		if (--pending == 0) {
+			done_condition.notify_one();
+		}
+	}
+}
+int WorkerPool::get_size() const {
+	return threads.size() + 1;
+}
+void WorkerPool::run(int count, int parts, const std::function<void(int, int)>& function) {
+	std::lock_guard<std::mutex> run_lock(run_mutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->function = &function;
+		this->count = count;
+		this->parts = parts;
+		pending = parts - 1;
+		++generation;
+	}
+	start_condition.notify_all();
+	function(0, count / parts);
+	std::unique_lock<std::mutex> lock(mutex);
+	done_condition.wait(lock, [&] { return pending == 0; });
+}
+static WorkerPool& get_worker_pool() {
+	static WorkerPool worker_pool;
+	return worker_pool;
+}
+
+// calls function(first, last) for consecutive ranges of [0, count), concurrently for large images
+template <class F> static void parallel_for(int count, int pixels, F function) {
+	if (pixels < PARALLEL_THRESHOLD) {
+		function(0, count);
+		return;
+	}
+	WorkerPool& worker_pool = get_worker_pool();
+	const int parts = std::max(1, std::min(worker_pool.get_size(), count));
+	if (parts == 1) {
+		function(0, count);
+		return;
+	}
+	worker_pool.run(count, parts, function);
+}
+
+static void box_blur_row(const unsigned char* src, unsigned char* dst, int width, int radius) {
+	const float scale = 1.f / (radius * 2 + 1);
+	int sum = (radius + 1) * src[0];
+	for (int i = 1; i <= radius; ++i) {
+		sum += src[std::min(i, width - 1)];
+	}
+	for (int x = 0; x < width; ++x) {
+		dst[x] = sum * scale + 0.5f;
+		sum += src[std::min(x + radius + 1, width - 1)] - src[std::max(x - radius, 0)];
+	}
+}
+
+// blurs the columns [x0, x1) of an image, the running sums of neighbouring columns are updated together
+static void box_blur_columns(const unsigned char* src, unsigned char* dst, int width, int height, int x0, int x1, int radius, std::vector<int>& sums) {
+	const float scale = 1.f / (radius * 2 + 1);
+	sums.resize(width);
+	for (int x = x0; x < x1; ++x) {
+		sums[x] = (radius + 1) * src[x];
+	}
+	for (int i = 1; i <= radius; ++i) {
+		const unsigned char* row = src + std::min(i, height - 1) * width;
+		for (int x = x0; x < x1; ++x) {
+			sums[x] += row[x];
+		}
+	}
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* add = src + std::min(y + radius + 1, height - 1) * width;
+		const unsigned char* remove = src + std::max(y - radius, 0) * width;
+		unsigned char* out = dst + y * width;
+		int x = x0;
+#if defined(__SSE2__)
+		const __m128 scale4 = _mm_set1_ps(scale);
+		const __m128 half4 = _mm_set1_ps(0.5f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 4 <= x1; x += 4) {
+			int add4, remove4;
+			std::memcpy(&add4, add + x, 4);
+			std::memcpy(&remove4, remove + x, 4);
+			__m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&sums[x]));
+			__m128i result = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale4), half4));
+			result = _mm_packs_epi32(result, result);
+			result = _mm_packus_epi16(result, result);
+			const int result4 = _mm_cvtsi128_si32(result);
+			std::memcpy(out + x, &result4, 4);
+			const __m128i added = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(add4), zero), zero);
+			const __m128i removed = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(remove4), zero), zero);
+			sum = _mm_sub_epi32(_mm_add_epi32(sum, added), removed);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&sums[x]), sum);
+		}
+#elif defined(__ARM_NEON)
+		const float32x4_t scale4 = vdupq_n_f32(scale);
+		const float32x4_t half4 = vdupq_n_f32(0.5f);
+		for (; x + 4 <= x1; x += 4) {
+			uint32_t add4, remove4;
+			std::memcpy(&add4, add + x, 4);
+			std::memcpy(&remove4, remove + x, 4);
+			int32x4_t sum = vld1q_s32(&sums[x]);
+			const uint32x4_t result = vcvtq_u32_f32(vaddq_f32(vmulq_f32(vcvtq_f32_s32(sum), scale4), half4));
+			const uint16x4_t result16 = vmovn_u32(result);
+			const uint8x8_t result8 = vmovn_u16(vcombine_u16(result16, result16));
+			vst1_lane_u32(reinterpret_cast<uint32_t*>(out + x), vreinterpret_u32_u8(result8), 0);
+			const int32x4_t added = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(add4))))));
+			const int32x4_t removed = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(remove4))))));
+			sum = vsubq_s32(vaddq_s32(sum, added), removed);
+			vst1q_s32(&sums[x], sum);
+		}
+#endif
+		for (; x < x1; ++x) {
+			out[x] = sums[x] * scale + 0.5f;
+			sums[x] += add[x] - remove[x];
+		}
+	}
+}
+
+// for small radii the boxes are too coarse and a direct convolution is just as cheap
+static constexpr int BOX_BLUR_THRESHOLD = 6;
+
+static void gaussian_blur(unsigned char* data, int width, int height, int radius) {
+	std::vector<float> kernel(radius * 2 + 1);
+	const float sigma = radius / 3.f;
+	float total = 0.f;
+	for (int i = 0; i < radius * 2 + 1; ++i) {
+		const float x = i - radius;
+		kernel[i] = expf(-x * x / (2.f * sigma * sigma));
+		total += kernel[i];
+	}
+	for (float& weight: kernel) {
+		weight /= total;
+	}
+	std::vector<unsigned char> tmp(width * height);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float sum = 0.f;
+			for (int k = 0; k < radius * 2 + 1; ++k) {
+				sum += data[y * width + std::clamp(x + k - radius, 0, width - 1)] * kernel[k];
+			}
+			tmp[y * width + x] = sum + 0.5f;
+		}
+	}
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float sum = 0.f;
+			for (int k = 0; k < radius * 2 + 1; ++k) {
+				sum += tmp[std::clamp(y + k - radius, 0, height - 1) * width + x] * kernel[k];
+			}
+			data[y * width + x] = sum + 0.5f;
+		}
+	}
+}
+
+void nitro::blur(unsigned char* data, int width, int height, int radius) {
+	if (radius <= 0 || width <= 0 || height <= 0) {
+		return;
+	}
+	if (radius < BOX_BLUR_THRESHOLD) {
+		gaussian_blur(data, width, height, radius);
+		return;
+	}
+	int radii[3];
+	get_box_radii(radius / 3.f, radii);
+	// every pass would replicate the edges of the previous pass instead of the edges of the image
+	// lines are extended by replicated edge pixels so that the clamping only ever sees those
+	const int padding = radii[0] + radii[1] + radii[2];
+	const int pixels = width * height;
+	parallel_for(height, pixels, [&](int y0, int y1) {
+		std::vector<unsigned char> a(width + padding * 2), b(width + padding * 2);
+		for (int y = y0; y < y1; ++y) {
+			unsigned char* row = data + y * width;
+			std::fill(a.begin(), a.begin() + padding, row[0]);
+			std::copy(row, row + width, a.begin() + padding);
+			std::fill(a.begin() + padding + width, a.end(), row[width - 1]);
+			box_blur_row(a.data(), b.data(), width + padding * 2, radii[0]);
+			box_blur_row(b.data(), a.data(), width + padding * 2, radii[1]);
+			box_blur_row(a.data(), b.data(), width + padding * 2, radii[2]);
+			std::copy(b.begin() + padding, b.begin() + padding + width, row);
+		}
+	});
+	const int padded_height = height + padding * 2;
+	std::vector<unsigned char> a(width * padded_height), b(width * padded_height);
+	for (int y = 0; y < padded_height; ++y) {
+		std::memcpy(a.data() + y * width, data + std::clamp(y - padding, 0, height - 1) * width, width);
+	}
+	// tiles of whole cache lines so that threads do not write to the same line
+	const int tiles = (width + 63) / 64;
+	parallel_for(tiles, pixels, [&](int first, int last) {
+		const int x0 = first * 64;
+		const int x1 = std::min(last * 64, width);
+		std::vector<int> sums;
+		box_blur_columns(a.data(), b.data(), width, padded_height, x0, x1, radii[0], sums);
+		box_blur_columns(b.data(), a.data(), width, padded_height, x0, x1, radii[1], sums);
+		box_blur_columns(a.data(), b.data(), width, padded_height, x0, x1, radii[2], sums);
+		for (int y = 0; y < height; ++y) {
+			std::memcpy(data + y * width + x0, b.data() + (y + padding) * width + x0, x1 - x0);
+		}
+	});
+}
@@ -18,72 +18,204 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include "nitro.hpp"
 #include <canvas.fs.glsl.h>
 #include <canvas.vs.glsl.h>
-#include <queue>
-#include <set>
 #include <algorithm>
+#include <tuple>
+#include <cstddef>
+#include <cstdint>
 #include <cassert>
 
 class CanvasProgram: public gles2::Program {
 public:
 	GLint projection_location;
-	GLint vertex_location;
-	GLint use_texture_location;
-	GLint use_mask_location;
-	GLint use_inverted_mask_location;
-	GLint color_location;
+	GLint depth_scale_location;
+	GLint tint_location;
 	GLint texture_location;
-	GLint texture_texcoord_location;
-	GLint alpha_location;
 	GLint mask_location;
-	GLint mask_texcoord_location;
 	GLint inverted_mask_location;
-	GLint inverted_mask_texcoord_location;
-	CanvasProgram(): gles2::Program(canvas_vs_glsl, canvas_fs_glsl) {
+	// all variants share the same attribute locations so that their vertex array objects are interchangeable
+	// GLES 2 only guarantees 8 attributes
+	enum Attribute {
+		VERTEX,
+		COLOR,
+		TEXTURE_TEXCOORD,
+		MASK_TEXCOORD,
+		INVERTED_MASK_TEXCOORD,
+		SHAPE_GEOMETRY,
+		INVERTED_SHAPE_GEOMETRY,
+		SHAPE_PARAMETERS
+	};
+	enum Variant {
+		TEXTURE = 1 << 0,
+		MASK = 1 << 1,
+		INVERTED_MASK = 1 << 2,
+		SHAPE = 1 << 3,
+		INVERTED_SHAPE = 1 << 4,
+		VARIANTS = 1 << 5
+	};
+	CanvasProgram(int variant): gles2::Program(canvas_vs_glsl[variant], canvas_fs_glsl[variant], {"vertex", "color", "texture_texcoord", "mask_texcoord", "inverted_mask_texcoord", "shape", "inverted_shape", "shape_parameters"}) {
 		projection_location = get_uniform_location("projection");
-		vertex_location = get_attribute_location("vertex");
-		use_texture_location = get_uniform_location("use_texture");
-		use_mask_location = get_uniform_location("use_mask");
-		use_inverted_mask_location = get_uniform_location("use_inverted_mask");
-		color_location = get_attribute_location("color");
+		depth_scale_location = get_uniform_location("depth_scale");
+		tint_location = get_uniform_location("tint");
 		texture_location = get_uniform_location("texture");
-		texture_texcoord_location = get_attribute_location("texture_texcoord");
-		alpha_location = get_uniform_location("alpha");
 		mask_location = get_uniform_location("mask");
-		mask_texcoord_location = get_attribute_location("mask_texcoord");
 		inverted_mask_location = get_uniform_location("inverted_mask");
-		inverted_mask_texcoord_location = get_attribute_location("inverted_mask_texcoord");
+	}
+	// returns the program without the features that are not needed
+	static CanvasProgram& get(int variant) {
+		static std::unique_ptr<CanvasProgram> programs[VARIANTS];
+		if (!programs[variant]) {
+			programs[variant] = std::make_unique<CanvasProgram>(variant);
+		}
+		return *programs[variant];
+	}
+	static CanvasProgram& get(const nitro::CanvasMaterial& material) {
+		return get((material.texture ? TEXTURE : 0) | (material.mask ? MASK : 0) | (material.inverted_mask ? INVERTED_MASK : 0) | (material.shape ? SHAPE : 0) | (material.inverted_shape ? INVERTED_SHAPE : 0));
 	}
 };
 
-nitro::CanvasElement::CanvasElement(float x0, float y0, float x1, float y1, const Color& color, const Texture& texture, float alpha, const Texture& mask, const Texture& inverted_mask): Rectangle(x0, y0, x1, y1), color(color), texture(texture), alpha(alpha), mask(mask), inverted_mask(inverted_mask) {
+static gles2::StreamBuffer& get_stream_buffer() {
+	static gles2::StreamBuffer stream_buffer;
+	return stream_buffer;
+}
 
+// returns nullptr if vertex array objects are not supported
+static gles2::VertexArray* get_stream_vertex_array() {
+	static std::unique_ptr<gles2::VertexArray> vertex_array = gles2::get_capabilities().vertex_array_objects ? std::make_unique<gles2::VertexArray>() : nullptr;
+	return vertex_array.get();
 }
 
-void nitro::CanvasElement::draw(const gles2::mat4& projection) const {
-	static CanvasProgram program;
-	const Quad vertices(x0, y0, x1, y1);
+static const GLvoid* vertex_offset(std::size_t offset) {
+	return reinterpret_cast<const GLvoid*>(offset);
+}
+
+static nitro::CanvasMaterial get_material(const nitro::CanvasElement& element) {
+	return nitro::CanvasMaterial {element.texture.texture.get(), element.mask.texture.get(), element.inverted_mask.texture.get(), element.shape, element.inverted_shape};
+}
+
+static void set_shape(GLfloat* data, const nitro::Shape& shape, float x, float y) {
+	if (shape) {
+		data[0] = x - (shape.x0 + shape.x1) / 2.f;
+		data[1] = y - (shape.y0 + shape.y1) / 2.f;
+		data[2] = (shape.x1 - shape.x0) / 2.f;
+		data[3] = (shape.y1 - shape.y0) / 2.f;
+	}
+}
+
+static float get_shape_radius(const nitro::Shape& shape) {
+	if (!shape) {
+		return 0.f;
+	}
+	return std::max(std::min({shape.radius, (shape.x1 - shape.x0) / 2.f, (shape.y1 - shape.y0) / 2.f}), 0.f);
+}
+
+static void append_vertices(const nitro::CanvasElement& element, std::vector<nitro::CanvasVertex>& vertices) {
+	// two triangles per element, the indices refer to the vertices of a Quad
+	constexpr int indices[] = {0, 1, 2, 2, 1, 3};
+	const nitro::Quad::Data position = nitro::Quad(element.x0, element.y0, element.x1, element.y1).get_data();
+	const nitro::Quad::Data texture_texcoord = element.texture.texcoord.get_data();
+	const nitro::Quad::Data mask_texcoord = element.mask.texcoord.get_data();
+	const nitro::Quad::Data inverted_mask_texcoord = element.inverted_mask.texcoord.get_data();
+	const gles2::vec4 color = element.texture ? gles2::vec4(1.f, 1.f, 1.f, element.alpha) : element.color.unpremultiply();
+	const float shape_radius = get_shape_radius(element.shape);
+	const float inverted_shape_radius = get_shape_radius(element.inverted_shape);
+	for (int i: indices) {
+		const float x = position.data[i*2];
+		const float y = position.data[i*2+1];
+		nitro::CanvasVertex vertex = {
+			x, y,
+			0.f,
+			{color[0], color[1], color[2], color[3]},
+			{texture_texcoord.data[i*2], texture_texcoord.data[i*2+1]},
+			{mask_texcoord.data[i*2], mask_texcoord.data[i*2+1]},
+			{inverted_mask_texcoord.data[i*2], inverted_mask_texcoord.data[i*2+1]},
+			{0.f, 0.f, 0.f, 0.f},
+			{0.f, 0.f, 0.f, 0.f},
+			{shape_radius, element.shape.sigma, inverted_shape_radius, element.inverted_shape.sigma}
+		};
+		set_shape(vertex.shape, element.shape, x, y);
+		set_shape(vertex.inverted_shape, element.inverted_shape, x, y);
+		vertices.push_back(vertex);
+	}
+}
+
+static void transform_vertices(nitro::CanvasVertex* begin, nitro::CanvasVertex* end, const nitro::Transformation& transformation) {
+	for (nitro::CanvasVertex* vertex = begin; vertex != end; ++vertex) {
+		const nitro::Point point = transformation * nitro::Point(vertex->x, vertex->y);
+		vertex->x = point.x;
+		vertex->y = point.y;
+	}
+}
+
+static nitro::Rectangle get_bounds(const nitro::CanvasVertex* begin, const nitro::CanvasVertex* end) {
+	nitro::Rectangle bounds(begin->x, begin->y, begin->x, begin->y);
+	for (const nitro::CanvasVertex* vertex = begin; vertex != end; ++vertex) {
+		bounds = bounds | nitro::Rectangle(vertex->x, vertex->y, vertex->x, vertex->y);
+	}
+	return bounds;
+}
+
+static bool intersects(const nitro::Rectangle& r1, const nitro::Rectangle& r2) {
+	const nitro::Rectangle r = r1 & r2;
+	return r.x0 < r.x1 && r.y0 < r.y1;
+}
+
+static void draw_vertices(gles2::VertexArray* vertex_array, gles2::Buffer* buffer, GLint first, GLsizei count, const nitro::CanvasMaterial& material, const gles2::mat4& projection, float depth_scale = 1.f, const gles2::vec4& tint = gles2::vec4(1.f)) {
+	CanvasProgram& program = CanvasProgram::get(material);
+	// the attribute arrays are always specified in full so that they never change for a given vertex array object
 	gles2::draw(
 		&program,
-		GL_TRIANGLE_STRIP,
-		4,
+		GL_TRIANGLES,
+		first,
+		count,
 		gles2::UniformMat4(program.projection_location, projection),
-		gles2::AttributeArray(program.vertex_location, 2, GL_FLOAT, vertices.get_data()),
-		gles2::UniformBool(program.use_texture_location, texture),
-		gles2::UniformBool(program.use_mask_location, mask),
-		gles2::UniformBool(program.use_inverted_mask_location, inverted_mask),
-		gles2::AttributeVec4(program.color_location, color.unpremultiply()),
-		gles2::TextureState(texture.texture.get(), GL_TEXTURE0, program.texture_location),
-		gles2::AttributeArray(program.texture_texcoord_location, 2, GL_FLOAT, texture.texcoord.get_data()),
-		gles2::UniformFloat(program.alpha_location, alpha),
-		gles2::TextureState(mask.texture.get(), GL_TEXTURE1, program.mask_location),
-		gles2::AttributeArray(program.mask_texcoord_location, 2, GL_FLOAT, mask.texcoord.get_data()),
-		gles2::TextureState(inverted_mask.texture.get(), GL_TEXTURE2, program.inverted_mask_location),
-		gles2::AttributeArray(program.inverted_mask_texcoord_location, 2, GL_FLOAT, inverted_mask.texcoord.get_data())
+		gles2::UniformFloat(program.depth_scale_location, depth_scale),
+		gles2::UniformVec4(program.tint_location, tint),
+		gles2::VertexArrayState(vertex_array),
+		gles2::BufferState(buffer),
+		gles2::AttributeArray(CanvasProgram::VERTEX, 3, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, x)), sizeof(nitro::CanvasVertex)),
+		gles2::AttributeArray(CanvasProgram::COLOR, 4, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, color)), sizeof(nitro::CanvasVertex)),
+		gles2::TextureState(material.texture, GL_TEXTURE0, program.texture_location),
+		gles2::AttributeArray(CanvasProgram::TEXTURE_TEXCOORD, 2, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, texture_texcoord)), sizeof(nitro::CanvasVertex)),
+		gles2::TextureState(material.mask, GL_TEXTURE1, program.mask_location),
+		gles2::AttributeArray(CanvasProgram::MASK_TEXCOORD, 2, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, mask_texcoord)), sizeof(nitro::CanvasVertex)),
+		gles2::TextureState(material.inverted_mask, GL_TEXTURE2, program.inverted_mask_location),
+		gles2::AttributeArray(CanvasProgram::INVERTED_MASK_TEXCOORD, 2, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, inverted_mask_texcoord)), sizeof(nitro::CanvasVertex)),
+		gles2::AttributeArray(CanvasProgram::SHAPE_GEOMETRY, 4, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, shape)), sizeof(nitro::CanvasVertex)),
+		gles2::AttributeArray(CanvasProgram::INVERTED_SHAPE_GEOMETRY, 4, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, inverted_shape)), sizeof(nitro::CanvasVertex)),
+		gles2::AttributeArray(CanvasProgram::SHAPE_PARAMETERS, 4, GL_FLOAT, vertex_offset(offsetof(nitro::CanvasVertex, shape_parameters)), sizeof(nitro::CanvasVertex))
 	);
 }
 
+bool nitro::CanvasMaterial::operator <(const CanvasMaterial& material) const {
+	return std::tie(texture, mask, inverted_mask, shape, inverted_shape) < std::tie(material.texture, material.mask, material.inverted_mask, material.shape, material.inverted_shape);
+}
+
+bool nitro::Shape::is_supported() {
+	return gles2::get_capabilities().fragment_precision_high;
+}
+
+nitro::CanvasElement::CanvasElement(float x0, float y0, float x1, float y1, const Color& color, const Texture& texture, float alpha, const Texture& mask, const Texture& inverted_mask, const Shape& shape, const Shape& inverted_shape): Rectangle(x0, y0, x1, y1), color(color), texture(texture), alpha(alpha), mask(mask), inverted_mask(inverted_mask), shape(shape), inverted_shape(inverted_shape) {
+
+}
+
+void nitro::CanvasElement::draw(const gles2::mat4& projection) const {
+	static std::vector<CanvasVertex> vertices;
+	vertices.clear();
+	append_vertices(*this, vertices);
+	gles2::StreamBuffer& stream_buffer = get_stream_buffer();
+	const GLint first = stream_buffer.write(vertices.data(), vertices.size(), sizeof(CanvasVertex));
+	draw_vertices(get_stream_vertex_array(), stream_buffer.get_buffer(), first, vertices.size(), get_material(*this), projection);
+}
+
 void nitro::Canvas::clear() {
 	elements.clear();
+	vertices.clear();
+	batches.clear();
+	depth_vertices = 0;
+	parts.clear();
+	swept_vertices.clear();
+	swept_batches.clear();
+	resizable = false;
 }
 
 void nitro::Canvas::set_color(float x0, float y0, float x1, float y1, const Color& color) {
@@ -110,147 +242,206 @@ void nitro::Canvas::set_inverted_mask(float x0, float y0, float x1, float y1, co
 	}
 }
 
-void nitro::Canvas::prepare() {
-	class Event {
-	public:
-		enum class Type {
-			START,
-			END
-		};
-		Type type;
-		const CanvasElement* element;
+void nitro::Canvas::set_shape(float x0, float y0, float x1, float y1, const Shape& shape) {
+	if (x0 < x1 && y0 < y1) {
+		elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, Texture(), Texture(), shape, Shape());
+	}
+}
+
+void nitro::Canvas::set_inverted_shape(float x0, float y0, float x1, float y1, const Shape& inverted_shape) {
+	if (x0 < x1 && y0 < y1) {
+		elements.emplace_back(x0, y0, x1, y1, Color(), Texture(), 0.f, Texture(), Texture(), Shape(), inverted_shape);
+	}
+}
+
+static nitro::Quad get_texcoord(const nitro::CanvasElement& element, float x0, float y0, float x1, float y1) {
+	return nitro::Quad(
+		(x0 - element.x0) / (element.x1 - element.x0),
+		(y0 - element.y0) / (element.y1 - element.y0),
+		(x1 - element.x0) / (element.x1 - element.x0),
+		(y1 - element.y0) / (element.y1 - element.y0)
+	);
+}
+
+static bool is_fill(const nitro::CanvasElement& element) {
+	return element.texture || !(element.mask || element.inverted_mask || element.shape || element.inverted_shape);
+}
+
+static bool is_visible(const nitro::CanvasElement& fill) {
+	return fill.texture ? fill.alpha > 0.f : static_cast<bool>(fill.color);
+}
+
+// the topmost element of each kind that covers a part of the canvas, nullptr if there is none
+struct CanvasLayers {
+	const nitro::CanvasElement* fill;
+	const nitro::CanvasElement* mask;
+	const nitro::CanvasElement* inverted_mask;
+	const nitro::CanvasElement* shape;
+	const nitro::CanvasElement* inverted_shape;
+};
+
+static void append_element(std::vector<nitro::CanvasElement>& elements, float x0, float y0, float x1, float y1, const CanvasLayers& layers) {
+	const nitro::CanvasElement& fill = *layers.fill;
+	elements.emplace_back(
+		x0, y0, x1, y1,
+		fill.texture ? nitro::Color() : fill.color,
+		fill.texture ? fill.texture * get_texcoord(fill, x0, y0, x1, y1) : nitro::Texture(),
+		fill.texture ? fill.alpha : 0.f,
+		layers.mask ? layers.mask->mask * get_texcoord(*layers.mask, x0, y0, x1, y1) : nitro::Texture(),
+		layers.inverted_mask ? layers.inverted_mask->inverted_mask * get_texcoord(*layers.inverted_mask, x0, y0, x1, y1) : nitro::Texture(),
+		// shapes are in canvas coordinates, so they apply to any part unchanged
+		layers.shape ? layers.shape->shape : nitro::Shape(),
+		layers.inverted_shape ? layers.inverted_shape->inverted_shape : nitro::Shape()
+	);
+}
+
+// splits the canvas into parts that are covered by the same elements and calls emit(x0, y0, x1, y1, layers) for each of them
+template <class F> static void sweep(const std::vector<nitro::CanvasElement>& elements, F emit) {
+	struct Event {
 		float y;
-		constexpr Event(Type type, const CanvasElement* element): type(type), element(element), y(type == Type::START ? element->y0 : element->y1) {}
-		constexpr bool operator >(const Event& event) const {
-			return y != event.y ? y > event.y : element > event.element;
+		std::uint32_t element;
+		bool end;
+		bool operator <(const Event& event) const {
+			return y != event.y ? y < event.y : element < event.element;
 		}
 	};
-
-	class ElementStack {
-		mutable float y0;
-		mutable std::set<const CanvasElement*> elements;
-	public:
+	// a column of the sweep, the elements covering it are a bit set in the words array
+	struct Stack {
 		float x0, x1;
-		ElementStack(const CanvasElement* element, float x0, float x1): y0(element->y0), x0(x0), x1(x1) {
-			elements.insert(element);
-		}
-		void insert(const CanvasElement* element) const {
-			elements.insert(element);
-		}
-		void remove(const CanvasElement* element) const {
-			elements.erase(element);
+		float y0;
+		std::size_t bits;
+	};
+
+	// the scratch buffers are reused between calls
+	static std::vector<Event> events;
+	static std::vector<Stack> stacks;
+	static std::vector<std::uint64_t> words;
+	static std::vector<std::size_t> free_bits;
+	events.clear();
+	stacks.clear();
+	words.clear();
+	free_bits.clear();
+	const std::size_t word_count = (elements.size() + 63) / 64;
+
+	auto allocate_bits = [&]() {
+		if (!free_bits.empty()) {
+			const std::size_t bits = free_bits.back();
+			free_bits.pop_back();
+			return bits;
 		}
-		bool empty() const {
-			return elements.empty();
+		const std::size_t bits = words.size();
+		words.resize(bits + word_count);
+		return bits;
+	};
+	auto create_stack = [&](std::uint32_t element, float x0, float x1) {
+		const std::size_t bits = allocate_bits();
+		std::fill_n(words.begin() + bits, word_count, 0);
+		words[bits + element / 64] |= std::uint64_t(1) << (element % 64);
+		return Stack {x0, x1, elements[element].y0, bits};
+	};
+	// splits a stack at x and returns the left part
+	auto split_stack = [&](Stack& stack, float x) {
+		Stack left = stack;
+		left.bits = allocate_bits();
+		std::copy_n(words.begin() + stack.bits, word_count, words.begin() + left.bits);
+		left.x1 = x;
+		stack.x0 = x;
+		return left;
+	};
+	// emits the part of the stack between its y0 and y1
+	auto emit_stack = [&](Stack& stack, float y1) {
+		if (stack.y0 == y1) {
+			return;
 		}
-		void get_element(float y1, std::vector<CanvasElement>& new_elements) const {
-			if (y0 == y1) {
-				return;
-			}
-			Color color;
-			Texture texture;
-			float alpha = 0.f;
-			Texture mask;
-			Texture inverted_mask;
-			for (const CanvasElement* element: elements) {
-				Quad quad(
-					(x0 - element->x0) / (element->x1 - element->x0),
-					(y0 - element->y0) / (element->y1 - element->y0),
-					(x1 - element->x0) / (element->x1 - element->x0),
-					(y1 - element->y0) / (element->y1 - element->y0)
-				);
+		CanvasLayers layers = {nullptr, nullptr, nullptr, nullptr, nullptr};
+		for (std::size_t i = 0; i < word_count; ++i) {
+			for (std::uint64_t word = words[stack.bits + i]; word; word &= word - 1) {
+				const nitro::CanvasElement* element = &elements[i * 64 + __builtin_ctzll(word)];
 				if (element->texture) {
-					color = Color();
-					texture = element->texture * quad;
-					alpha = element->alpha;
+					layers.fill = element;
 				}
 				else if (element->mask) {
-					mask = element->mask * quad;
+					layers.mask = element;
 				}
 				else if (element->inverted_mask) {
-					inverted_mask = element->inverted_mask * quad;
+					layers.inverted_mask = element;
+				}
+				else if (element->shape) {
+					layers.shape = element;
+				}
+				else if (element->inverted_shape) {
+					layers.inverted_shape = element;
 				}
 				else {
-					color = element->color;
-					texture = Texture();
-					alpha = 0.f;
+					layers.fill = element;
 				}
 			}
-			if (color || (texture && alpha > 0.f)) {
-				new_elements.push_back(CanvasElement(x0, y0, x1, y1, color, texture, alpha, mask, inverted_mask));
-			}
-			y0 = y1;
-		}
-		ElementStack split_horizontally(float x) {
-			ElementStack left = *this;
-			left.x1 = x;
-			x0 = x;
-			return left;
-		}
-		bool operator <(const ElementStack& element_stack) const {
-			return x0 < element_stack.x0;
 		}
+		emit(stack.x0, stack.y0, stack.x1, y1, layers);
+		stack.y0 = y1;
+	};
+	auto is_empty = [&](const Stack& stack) {
+		return std::all_of(words.begin() + stack.bits, words.begin() + stack.bits + word_count, [](std::uint64_t word) {
+			return word == 0;
+		});
 	};
 
 	// collect events
-	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
-	for (const CanvasElement& element: elements) {
-		events.emplace(Event::Type::START, &element);
-		events.emplace(Event::Type::END, &element);
-	}
-
-	// process events
-	std::vector<CanvasElement> new_elements;
-	std::set<ElementStack> stacks;
-	while (!events.empty()) {
-		Event event = events.top();
-		events.pop();
-		const CanvasElement* element = event.element;
-		auto i0 = std::upper_bound(stacks.begin(), stacks.end(), element->x0, [](float x, const ElementStack& stack) {
+	events.reserve(elements.size() * 2);
+	for (std::uint32_t i = 0; i < elements.size(); ++i) {
+		events.push_back(Event {elements[i].y0, i, false});
+		events.push_back(Event {elements[i].y1, i, true});
+	}
+	std::sort(events.begin(), events.end());
+
+	// process events, the stacks are sorted by x and do not overlap
+	for (const Event& event: events) {
+		const nitro::CanvasElement& element = elements[event.element];
+		const std::uint64_t bit = std::uint64_t(1) << (event.element % 64);
+		std::size_t i0 = std::upper_bound(stacks.begin(), stacks.end(), element.x0, [](float x, const Stack& stack) {
 			return x < stack.x1;
-		});
-		auto i1 = std::lower_bound(stacks.begin(), stacks.end(), element->x1, [](const ElementStack& stack, float x) {
+		}) - stacks.begin();
+		std::size_t i1 = std::lower_bound(stacks.begin(), stacks.end(), element.x1, [](const Stack& stack, float x) {
 			return stack.x0 < x;
-		});
-		if (event.type == Event::Type::START) {
-			float x = element->x0;
+		}) - stacks.begin();
+		if (!event.end) {
+			float x = element.x0;
 			while (i0 != i1) {
-				assert(i0->x1 > element->x0 && i0->x0 < element->x1);
-				if (i0->x0 < element->x0) {
-					assert(i0->x0 < element->x0 && element->x0 < i0->x1);
-					ElementStack stack = *i0;
-					stacks.erase(i0);
-					ElementStack left = stack.split_horizontally(element->x0);
-					stacks.insert(left);
-					i0 = stacks.insert(stack).first;
+				assert(stacks[i0].x1 > element.x0 && stacks[i0].x0 < element.x1);
+				if (stacks[i0].x0 < element.x0) {
+					const Stack left = split_stack(stacks[i0], element.x0);
+					stacks.insert(stacks.begin() + i0, left);
+					++i0;
+					++i1;
 				}
-				if (element->x1 < i0->x1) {
-					assert(i0->x0 < element->x1 && element->x1 < i0->x1);
-					ElementStack stack = *i0;
-					stacks.erase(i0);
-					ElementStack left = stack.split_horizontally(element->x1);
-					i0 = stacks.insert(left).first;
-					i1 = stacks.insert(stack).first;
+				if (element.x1 < stacks[i0].x1) {
+					const Stack left = split_stack(stacks[i0], element.x1);
+					stacks.insert(stacks.begin() + i0, left);
+					i1 = i0 + 1;
 				}
-				if (x < i0->x0) {
+				if (x < stacks[i0].x0) {
 					// fill the gap
-					stacks.insert(ElementStack(element, x, i0->x0));
+					stacks.insert(stacks.begin() + i0, create_stack(event.element, x, stacks[i0].x0));
+					++i0;
+					++i1;
 				}
-				i0->get_element(event.y, new_elements);
-				i0->insert(element);
-				x = i0->x1;
+				emit_stack(stacks[i0], event.y);
+				words[stacks[i0].bits + event.element / 64] |= bit;
+				x = stacks[i0].x1;
 				++i0;
 			}
-			if (x < element->x1) {
-				stacks.insert(ElementStack(element, x, element->x1));
+			if (x < element.x1) {
+				stacks.insert(stacks.begin() + i0, create_stack(event.element, x, element.x1));
 			}
 		}
 		else {
 			while (i0 != i1) {
-				i0->get_element(event.y, new_elements);
-				i0->remove(element);
-				if (i0->empty()) {
-					i0 = stacks.erase(i0);
+				emit_stack(stacks[i0], event.y);
+				words[stacks[i0].bits + event.element / 64] &= ~bit;
+				if (is_empty(stacks[i0])) {
+					free_bits.push_back(stacks[i0].bits);
+					stacks.erase(stacks.begin() + i0);
+					--i1;
 				}
 				else {
 					++i0;
@@ -259,11 +450,553 @@ void nitro::Canvas::prepare() {
 		}
 	}
 	assert(stacks.empty());
-	elements = new_elements;
 }
 
-void nitro::Canvas::draw(const gles2::mat4& projection) const {
+nitro::Canvas::Canvas(): direct(false), depth_vertices(0), depth_steps(0), width(0.f), height(0.f), margin(0.f), resizable(false) {
+
+}
+
+// a texture that spans the middle of a resizable canvas has to be constant along that axis, otherwise stretching it would change it
+static bool is_constant(const nitro::Texture& texture, bool x, bool y) {
+	const nitro::Quad::Data data = texture.texcoord.get_data();
+	return (!x || (data.data[2] == data.data[0] && data.data[3] == data.data[1])) && (!y || (data.data[4] == data.data[0] && data.data[5] == data.data[1]));
+}
+
+void nitro::Canvas::set_direct(bool direct) {
+	this->direct = direct;
+}
+
+void nitro::Canvas::prepare() {
+	resizable = false;
+	build();
+}
+
+void nitro::Canvas::prepare(float width, float height, float margin) {
+	// every coordinate has to be close enough to one of the edges to know which one it follows
+	bool resizable = margin < width - margin && margin < height - margin;
+	auto is_anchored = [&](float x0, float y0, float x1, float y1) {
+		return (x0 <= margin || x0 >= width - margin) && (x1 <= margin || x1 >= width - margin) && (y0 <= margin || y0 >= height - margin) && (y1 <= margin || y1 >= height - margin);
+	};
 	for (const CanvasElement& element: elements) {
-		element.draw(projection);
+		if (!is_anchored(element.x0, element.y0, element.x1, element.y1)) {
+			resizable = false;
+		}
+		for (const Shape* shape: {&element.shape, &element.inverted_shape}) {
+			if (*shape && !is_anchored(shape->x0, shape->y0, shape->x1, shape->y1)) {
+				resizable = false;
+			}
+		}
+		const bool spans_x = element.x0 <= margin && element.x1 >= width - margin;
+		const bool spans_y = element.y0 <= margin && element.y1 >= height - margin;
+		for (const Texture* texture: {&element.texture, &element.mask, &element.inverted_mask}) {
+			if (*texture && !is_constant(*texture, spans_x, spans_y)) {
+				resizable = false;
+			}
+		}
 	}
+	build();
+	this->width = width;
+	this->height = height;
+	this->margin = margin;
+	this->resizable = resizable;
+}
+
+bool nitro::Canvas::resize(float width, float height) {
+	if (!resizable) {
+		return false;
+	}
+	const float dx = width - this->width;
+	const float dy = height - this->height;
+	if (!(margin < width - margin && margin < height - margin)) {
+		return false;
+	}
+	auto move = [&](float& x0, float& y0, float& x1, float& y1) {
+		x0 = x0 <= margin ? x0 : x0 + dx;
+		y0 = y0 <= margin ? y0 : y0 + dy;
+		x1 = x1 <= margin ? x1 : x1 + dx;
+		y1 = y1 <= margin ? y1 : y1 + dy;
+	};
+	auto move_element = [&](CanvasElement& element) {
+		move(element.x0, element.y0, element.x1, element.y1);
+		if (element.shape) {
+			move(element.shape.x0, element.shape.y0, element.shape.x1, element.shape.y1);
+		}
+		if (element.inverted_shape) {
+			move(element.inverted_shape.x0, element.inverted_shape.y0, element.inverted_shape.x1, element.inverted_shape.y1);
+		}
+	};
+	for (CanvasElement& element: elements) {
+		move_element(element);
+	}
+	this->width = width;
+	this->height = height;
+	if (depth_vertices > 0) {
+		// the parts of a direct canvas are cut at the edges of the elements, so they follow them the same way
+		for (DirectPart& part: parts) {
+			move_element(part.element);
+		}
+		swept_vertices.clear();
+		swept_batches.clear();
+		upload_direct();
+	}
+	else {
+		upload_elements();
+	}
+	return true;
+}
+
+const std::vector<nitro::CanvasElement>& nitro::Canvas::get_elements() const {
+	return elements;
+}
+
+static void sweep_elements(const std::vector<nitro::CanvasElement>& elements, std::vector<nitro::CanvasElement>& new_elements) {
+	new_elements.clear();
+	sweep(elements, [&](float x0, float y0, float x1, float y1, const CanvasLayers& layers) {
+		if (layers.fill && is_visible(*layers.fill)) {
+			append_element(new_elements, x0, y0, x1, y1, layers);
+		}
+	});
+	// the prepared elements do not overlap, so they can be reordered to group elements with the same textures
+	std::stable_sort(new_elements.begin(), new_elements.end(), [](const nitro::CanvasElement& lhs, const nitro::CanvasElement& rhs) {
+		return get_material(lhs) < get_material(rhs);
+	});
+}
+
+static void append_batches(const std::vector<nitro::CanvasElement>& elements, std::vector<nitro::CanvasVertex>& vertices, std::vector<nitro::CanvasBatch>& batches) {
+	for (const nitro::CanvasElement& element: elements) {
+		if (batches.empty() || batches.back().material != get_material(element)) {
+			batches.push_back(nitro::CanvasBatch {get_material(element), static_cast<GLint>(vertices.size()), 0});
+		}
+		append_vertices(element, vertices);
+		batches.back().count += 6;
+	}
+}
+
+// whether the bound framebuffer has enough depth bits to tell the given number of fills apart
+static bool has_depth_steps(std::size_t steps) {
+	const GLint depth_bits = gles2::StateCache::get_depth_bits();
+	return depth_bits > 0 && steps + 1 < (1u << std::min(depth_bits, 24)) / 4;
+}
+
+void nitro::Canvas::build() {
+	depth_vertices = 0;
+	parts.clear();
+	swept_vertices.clear();
+	swept_batches.clear();
+	if (direct && prepare_direct()) {
+		return;
+	}
+	static std::vector<CanvasElement> new_elements;
+	sweep_elements(elements, new_elements);
+	elements.swap(new_elements);
+	// release the textures of the old elements but keep the memory
+	new_elements.clear();
+	upload_elements();
+}
+
+void nitro::Canvas::upload_elements() {
+	vertices.clear();
+	batches.clear();
+	append_batches(elements, vertices, batches);
+	upload();
+}
+
+// a direct canvas can be drawn to another framebuffer than the one that was bound in prepare()
+// if that one does not have enough depth bits, the original elements are swept after all and kept until the next prepare()
+void nitro::Canvas::prepare_swept() const {
+	if (!swept_batches.empty() || elements.empty()) {
+		return;
+	}
+	static std::vector<CanvasElement> new_elements;
+	sweep_elements(elements, new_elements);
+	append_batches(new_elements, swept_vertices, swept_batches);
+	new_elements.clear();
+}
+
+// the fills are not swept against each other, instead the depth buffer keeps the index of the topmost fill of every pixel
+// only the masks and shapes are swept, and every fill is cut into the parts of that sweep it overlaps
+// the framebuffer it is drawn to is only known in draw(), which falls back to the sweep if its depth buffer is too small
+bool nitro::Canvas::prepare_direct() {
+	static std::vector<const CanvasElement*> fills;
+	static std::vector<CanvasElement> modulators;
+	fills.clear();
+	modulators.clear();
+	for (const CanvasElement& element: elements) {
+		if (is_fill(element)) {
+			fills.push_back(&element);
+		}
+	}
+	// without fills nothing is visible, the sweep finds that out cheaply
+	if (fills.empty() || fills.size() + 1 >= (1u << 24) / 4) {
+		return false;
+	}
+	// a transparent element covering all fills makes the sweep emit every part, including the ones without masks
+	Rectangle bounds = *fills.front();
+	for (const CanvasElement* fill: fills) {
+		bounds = bounds | *fill;
+	}
+	modulators.emplace_back(bounds.x0, bounds.y0, bounds.x1, bounds.y1, Color(), Texture(), 0.f, Texture(), Texture());
+	for (const CanvasElement& element: elements) {
+		if (!is_fill(element)) {
+			modulators.push_back(element);
+		}
+	}
+	struct Region {
+		Rectangle rectangle;
+		CanvasLayers layers;
+	};
+	static std::vector<Region> regions;
+	regions.clear();
+	sweep(modulators, [&](float x0, float y0, float x1, float y1, const CanvasLayers& layers) {
+		regions.push_back(Region {Rectangle(x0, y0, x1, y1), layers});
+	});
+	static std::vector<CanvasElement> part_elements;
+	parts.clear();
+	for (std::size_t i = 0; i < fills.size(); ++i) {
+		if (!is_visible(*fills[i])) {
+			continue;
+		}
+		for (const Region& region: regions) {
+			const Rectangle r = region.rectangle & *fills[i];
+			if (r.x0 < r.x1 && r.y0 < r.y1) {
+				CanvasLayers layers = region.layers;
+				layers.fill = fills[i];
+				part_elements.clear();
+				append_element(part_elements, r.x0, r.y0, r.x1, r.y1, layers);
+				// half a step in front of the fill, so that it only passes the depth test where the fill is the topmost one
+				parts.push_back(DirectPart {std::move(part_elements.back()), i + 0.5f});
+			}
+		}
+	}
+	part_elements.clear();
+	// every pixel is drawn by at most one part, so they can be reordered to group parts with the same textures
+	std::stable_sort(parts.begin(), parts.end(), [](const DirectPart& lhs, const DirectPart& rhs) {
+		return get_material(lhs.element) < get_material(rhs.element);
+	});
+	depth_steps = fills.size();
+	upload_direct();
+	return true;
+}
+
+// the fills of the depth pass come first, in their original order
+void nitro::Canvas::upload_direct() {
+	vertices.clear();
+	batches.clear();
+	std::size_t i = 0;
+	for (const CanvasElement& fill: elements) {
+		if (!is_fill(fill)) {
+			continue;
+		}
+		append_vertices(CanvasElement(fill.x0, fill.y0, fill.x1, fill.y1, Color(), Texture(), 0.f, Texture(), Texture()), vertices);
+		for (std::size_t j = vertices.size() - 6; j < vertices.size(); ++j) {
+			vertices[j].depth = i;
+		}
+		++i;
+	}
+	depth_vertices = vertices.size();
+	for (const DirectPart& part: parts) {
+		if (batches.empty() || batches.back().material != get_material(part.element)) {
+			batches.push_back(CanvasBatch {get_material(part.element), static_cast<GLint>(vertices.size()), 0});
+		}
+		append_vertices(part.element, vertices);
+		for (std::size_t j = vertices.size() - 6; j < vertices.size(); ++j) {
+			vertices[j].depth = part.depth;
+		}
+		batches.back().count += 6;
+	}
+	upload();
+}
+
+void nitro::Canvas::upload() {
+	if (vertices.empty()) {
+		return;
+	}
+	if (!buffer) {
+		buffer = std::make_shared<gles2::Buffer>();
+		if (gles2::get_capabilities().vertex_array_objects) {
+			vertex_array = std::make_shared<gles2::VertexArray>();
+		}
+	}
+	buffer->set_data(vertices.size() * sizeof(CanvasVertex), vertices.data());
+}
+
+void nitro::Canvas::load_programs() {
+	const bool shapes = Shape::is_supported();
+	for (int variant = 0; variant < CanvasProgram::VARIANTS; ++variant) {
+		if (shapes || !(variant & (CanvasProgram::SHAPE | CanvasProgram::INVERTED_SHAPE))) {
+			CanvasProgram::get(variant);
+		}
+	}
+}
+
+void nitro::Canvas::draw(const gles2::mat4& projection) const {
+	if (depth_vertices == 0) {
+		for (const CanvasBatch& batch: batches) {
+			draw_vertices(vertex_array.get(), buffer.get(), batch.first, batch.count, batch.material, projection);
+		}
+		return;
+	}
+	if (!has_depth_steps(depth_steps)) {
+		prepare_swept();
+		if (swept_vertices.empty()) {
+			return;
+		}
+		gles2::StreamBuffer& stream_buffer = get_stream_buffer();
+		const GLint first = stream_buffer.write(swept_vertices.data(), swept_vertices.size(), sizeof(CanvasVertex));
+		for (const CanvasBatch& batch: swept_batches) {
+			draw_vertices(get_stream_vertex_array(), stream_buffer.get_buffer(), first + batch.first, batch.count, batch.material, projection);
+		}
+		return;
+	}
+	draw_direct(projection);
+}
+
+void nitro::Canvas::draw_direct(const gles2::mat4& projection) const {
+	const float depth_scale = 2.f / (depth_steps + 1);
+	// the depth pass leaves the index of the topmost fill in the depth buffer
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	draw_vertices(vertex_array.get(), buffer.get(), 0, depth_vertices, CanvasMaterial {nullptr, nullptr, nullptr, false, false}, projection, depth_scale);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_FALSE);
+	glDepthFunc(GL_LESS);
+	for (const CanvasBatch& batch: batches) {
+		draw_vertices(vertex_array.get(), buffer.get(), batch.first, batch.count, batch.material, projection, depth_scale);
+	}
+	glDepthMask(GL_TRUE);
+	glDisable(GL_DEPTH_TEST);
+}
+
+void nitro::Canvas::draw(const DrawContext& draw_context) const {
+	if (draw_context.render_list == nullptr) {
+		draw(draw_context.projection);
+		return;
+	}
+	if (depth_vertices > 0) {
+		if (has_depth_steps(depth_steps)) {
+			// direct canvases need the depth buffer, so everything that was collected so far is drawn first
+			draw_context.render_list->flush();
+			draw_direct(draw_context.projection);
+			return;
+		}
+		prepare_swept();
+		for (const CanvasBatch& batch: swept_batches) {
+			draw_context.render_list->add(batch, swept_vertices.data(), draw_context.transformation);
+		}
+		return;
+	}
+	for (const CanvasBatch& batch: batches) {
+		draw_context.render_list->add(batch, vertices.data(), draw_context.transformation);
+	}
+}
+
+// Mesh
+nitro::Mesh::Mesh() {
+
+}
+
+void nitro::Mesh::clear() {
+	vertices.clear();
+	batches.clear();
+}
+
+void nitro::Mesh::add(const CanvasElement& element) {
+	if (batches.empty() || batches.back().material != get_material(element)) {
+		batches.push_back(CanvasBatch {get_material(element), static_cast<GLint>(vertices.size()), 0});
+	}
+	append_vertices(element, vertices);
+	batches.back().count += 6;
+}
+
+void nitro::Mesh::prepare() {
+	if (vertices.empty()) {
+		return;
+	}
+	if (!buffer) {
+		buffer = std::make_unique<gles2::Buffer>();
+		if (gles2::get_capabilities().vertex_array_objects) {
+			vertex_array = std::make_unique<gles2::VertexArray>();
+		}
+	}
+	buffer->set_data(vertices.size() * sizeof(CanvasVertex), vertices.data());
+}
+
+void nitro::Mesh::draw(const DrawContext& draw_context, const Color& tint) const {
+	const gles2::vec4 unpremultiplied_tint = tint.unpremultiply();
+	for (const CanvasBatch& batch: batches) {
+		if (draw_context.render_list) {
+			draw_context.render_list->add(batch, vertices.data(), draw_context.transformation, unpremultiplied_tint);
+		}
+		else {
+			draw_vertices(vertex_array.get(), buffer.get(), batch.first, batch.count, batch.material, draw_context.projection, 1.f, unpremultiplied_tint);
+		}
+	}
+}
+
+// RenderList
+nitro::RenderList::RenderList(const gles2::mat4& projection): projection(projection), batch_count(0), opaque_batch_count(0), draw_calls(0), depth_bits(0), depth(0) {
+
+}
+
+void nitro::RenderList::set_projection(const gles2::mat4& projection) {
+	this->projection = projection;
+}
+
+nitro::RenderList::Batch& nitro::RenderList::get_batch(const CanvasMaterial& material, const Rectangle& bounds) {
+	// look for an earlier batch with the same textures, as long as the primitive does not overlap anything that is drawn after that batch
+	constexpr std::size_t MAX_LOOKBACK = 64;
+	for (std::size_t i = batch_count; i > 0 && batch_count - i < MAX_LOOKBACK; --i) {
+		Batch& batch = batches[i - 1];
+		if (batch.material == material) {
+			batch.bounds = batch.bounds | bounds;
+			return batch;
+		}
+		if (intersects(batch.bounds, bounds)) {
+			break;
+		}
+	}
+	if (batch_count == batches.size()) {
+		batches.emplace_back();
+	}
+	Batch& batch = batches[batch_count];
+	++batch_count;
+	batch.material = material;
+	batch.bounds = bounds;
+	batch.vertices.clear();
+	return batch;
+}
+
+nitro::RenderList::Batch& nitro::RenderList::get_opaque_batch(gles2::Texture* texture) {
+	// opaque primitives can be drawn in any order, so there is one batch per texture
+	for (std::size_t i = 0; i < opaque_batch_count; ++i) {
+		if (opaque_batches[i].material.texture == texture) {
+			return opaque_batches[i];
+		}
+	}
+	if (opaque_batch_count == opaque_batches.size()) {
+		opaque_batches.emplace_back();
+	}
+	Batch& batch = opaque_batches[opaque_batch_count];
+	++opaque_batch_count;
+	batch.material = CanvasMaterial {texture, nullptr, nullptr, false, false};
+	batch.vertices.clear();
+	return batch;
+}
+
+void nitro::RenderList::add(const CanvasMaterial& material, std::vector<CanvasVertex>& vertices) {
+	if (batch_count == 0 && opaque_batch_count == 0) {
+		// the render target might have changed since the last flush
+		depth_bits = gles2::StateCache::get_depth_bits();
+		depth = 0;
+	}
+	for (CanvasVertex& vertex: vertices) {
+		vertex.depth = depth;
+	}
+	++depth;
+	if (depth_bits > 0 && material.mask == nullptr && material.inverted_mask == nullptr && !material.shape && !material.inverted_shape && (material.texture == nullptr || material.texture->opaque)) {
+		// move the opaque quads to the opaque pass and keep the others in order
+		std::size_t translucent_end = 0;
+		for (std::size_t i = 0; i < vertices.size(); i += 6) {
+			if (vertices[i].color[3] == 1.f) {
+				Batch& batch = get_opaque_batch(material.texture);
+				batch.vertices.insert(batch.vertices.end(), vertices.begin() + i, vertices.begin() + i + 6);
+			}
+			else {
+				std::copy(vertices.begin() + i, vertices.begin() + i + 6, vertices.begin() + translucent_end);
+				translucent_end += 6;
+			}
+		}
+		vertices.resize(translucent_end);
+	}
+	if (!vertices.empty()) {
+		Batch& batch = get_batch(material, get_bounds(vertices.data(), vertices.data() + vertices.size()));
+		batch.vertices.insert(batch.vertices.end(), vertices.begin(), vertices.end());
+	}
+	// start over before the depth buffer runs out of distinct values
+	if (depth_bits > 0 && depth >= (1u << std::min(depth_bits, 24)) / 4 - 1) {
+		flush();
+	}
+}
+
+void nitro::RenderList::add(const CanvasElement& element, const Transformation& transformation) {
+	std::vector<CanvasVertex>& vertices = this->vertices;
+	vertices.clear();
+	append_vertices(element, vertices);
+	transform_vertices(vertices.data(), vertices.data() + vertices.size(), transformation);
+	add(get_material(element), vertices);
+}
+
+void nitro::RenderList::add(const CanvasBatch& canvas_batch, const CanvasVertex* vertices, const Transformation& transformation, const gles2::vec4& tint) {
+	std::vector<CanvasVertex>& transformed_vertices = this->vertices;
+	transformed_vertices.assign(vertices + canvas_batch.first, vertices + canvas_batch.first + canvas_batch.count);
+	transform_vertices(transformed_vertices.data(), transformed_vertices.data() + transformed_vertices.size(), transformation);
+	// the vertices are copied anyway, so the tint is applied to them instead of splitting the batch
+	if (tint[0] != 1.f || tint[1] != 1.f || tint[2] != 1.f || tint[3] != 1.f) {
+		for (CanvasVertex& vertex: transformed_vertices) {
+			for (int i = 0; i < 4; ++i) {
+				vertex.color[i] *= tint[i];
+			}
+		}
+	}
+	add(canvas_batch.material, transformed_vertices);
+}
+
+void nitro::RenderList::flush() {
+	if (batch_count == 0 && opaque_batch_count == 0) {
+		return;
+	}
+	vertices.clear();
+	// the opaque quads are drawn front to back so that hidden fragments fail the depth test early
+	for (std::size_t i = 0; i < opaque_batch_count; ++i) {
+		const std::vector<CanvasVertex>& batch_vertices = opaque_batches[i].vertices;
+		for (std::size_t j = batch_vertices.size(); j > 0; j -= 6) {
+			vertices.insert(vertices.end(), batch_vertices.begin() + (j - 6), batch_vertices.begin() + j);
+		}
+	}
+	for (std::size_t i = 0; i < batch_count; ++i) {
+		vertices.insert(vertices.end(), batches[i].vertices.begin(), batches[i].vertices.end());
+	}
+	gles2::StreamBuffer& stream_buffer = get_stream_buffer();
+	GLint first = stream_buffer.write(vertices.data(), vertices.size(), sizeof(CanvasVertex));
+	const float depth_scale = 2.f / (depth + 1);
+	if (opaque_batch_count > 0) {
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glDisable(GL_BLEND);
+		for (std::size_t i = 0; i < opaque_batch_count; ++i) {
+			const Batch& batch = opaque_batches[i];
+			const GLsizei count = batch.vertices.size();
+			draw_vertices(get_stream_vertex_array(), stream_buffer.get_buffer(), first, count, batch.material, projection, depth_scale);
+			first += count;
+			++draw_calls;
+		}
+		// the translucent primitives are tested against the opaque ones but do not write depth
+		glEnable(GL_BLEND);
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_LEQUAL);
+	}
+	for (std::size_t i = 0; i < batch_count; ++i) {
+		const Batch& batch = batches[i];
+		const GLsizei count = batch.vertices.size();
+		draw_vertices(get_stream_vertex_array(), stream_buffer.get_buffer(), first, count, batch.material, projection, depth_scale);
+		first += count;
+		++draw_calls;
+	}
+	if (opaque_batch_count > 0) {
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+	}
+	batch_count = 0;
+	opaque_batch_count = 0;
+}
+
+void nitro::RenderList::begin_frame() {
+	draw_calls = 0;
+}
+
+unsigned int nitro::RenderList::get_draw_calls() const {
+	return draw_calls;
 }
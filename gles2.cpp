@@ -16,11 +16,150 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 */
 
 #include "gles2.hpp"
+#include <string>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace gles2 {
 
+static bool fragment_precision_high() {
+	GLint range[2];
+	GLint precision = 0;
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+	return precision > 0;
+}
+
+const Capabilities& get_capabilities() {
+	static const Capabilities capabilities = [] {
+		const int version = epoxy_gl_version();
+		return Capabilities {
+			version,
+			version >= 30 || epoxy_has_gl_extension("GL_OES_vertex_array_object"),
+			version >= 30 || epoxy_has_gl_extension("GL_EXT_instanced_arrays") || epoxy_has_gl_extension("GL_ANGLE_instanced_arrays"),
+			version >= 30 || epoxy_has_gl_extension("GL_EXT_map_buffer_range"),
+			fragment_precision_high()
+		};
+	}();
+	return capabilities;
+}
+
+// StateCache
+GLuint StateCache::program = 0;
+std::vector<StateCache::Value>* StateCache::uniforms = nullptr;
+std::map<GLuint, std::vector<StateCache::Value>> StateCache::program_uniforms;
+GLenum StateCache::active_texture = GL_TEXTURE0;
+GLuint StateCache::textures[MAX_TEXTURE_UNITS] = {};
+GLuint StateCache::array_buffer = 0;
+GLuint StateCache::draw_buffer = 0;
+GLuint StateCache::vertex_array = 0;
+GLuint StateCache::draw_vertex_array = 0;
+GLuint StateCache::framebuffer = 0;
+GLint StateCache::depth_bits = -1;
+StateCache::Attributes StateCache::default_attributes = {};
+std::map<GLuint, StateCache::Attributes> StateCache::vertex_array_attributes;
+StateCache::Attributes* StateCache::attributes = &StateCache::default_attributes;
+std::uint32_t StateCache::used_attributes = 0;
+StateCache::Value StateCache::attribute_values[MAX_ATTRIBUTES] = {};
+Statistics StateCache::statistics = {0, 0, 0};
+StateCache::Value* StateCache::get_uniform(GLint location) {
+	if (location < 0 || uniforms == nullptr) {
+		++statistics.skipped_calls;
+		return nullptr;
+	}
+	if (static_cast<std::size_t>(location) >= uniforms->size()) {
+		uniforms->resize(location + 1, Value {{}, false});
+	}
+	return &(*uniforms)[location];
+}
+void StateCache::forget_program(GLuint program) {
+	program_uniforms.erase(program);
+	if (program == StateCache::program) {
+		StateCache::program = 0;
+		uniforms = nullptr;
+	}
+}
+void StateCache::forget_texture(GLuint texture) {
+	// deleting a texture unbinds it from all texture units
+	for (GLuint& bound_texture: textures) {
+		if (bound_texture == texture) {
+			bound_texture = 0;
+		}
+	}
+}
+void StateCache::forget_buffer(GLuint buffer) {
+	if (buffer == array_buffer) {
+		array_buffer = 0;
+	}
+	for (AttributePointer& attribute_pointer: default_attributes.attribute_pointers) {
+		if (attribute_pointer.buffer == buffer) {
+			attribute_pointer.valid = false;
+		}
+	}
+	for (auto& entry: vertex_array_attributes) {
+		for (AttributePointer& attribute_pointer: entry.second.attribute_pointers) {
+			if (attribute_pointer.buffer == buffer) {
+				attribute_pointer.valid = false;
+			}
+		}
+	}
+}
+void StateCache::forget_vertex_array(GLuint vertex_array) {
+	// deleting the bound vertex array object reverts to the default one
+	if (vertex_array == StateCache::vertex_array) {
+		StateCache::vertex_array = 0;
+		attributes = &default_attributes;
+	}
+	vertex_array_attributes.erase(vertex_array);
+}
+void StateCache::forget_framebuffer(GLuint framebuffer) {
+	// deleting the bound framebuffer reverts to the default one
+	if (framebuffer == StateCache::framebuffer) {
+		StateCache::framebuffer = 0;
+		depth_bits = -1;
+	}
+}
+void StateCache::invalidate() {
+	glUseProgram(0);
+	program = 0;
+	uniforms = nullptr;
+	program_uniforms.clear();
+	glActiveTexture(GL_TEXTURE0);
+	active_texture = GL_TEXTURE0;
+	for (int i = 0; i < MAX_TEXTURE_UNITS; ++i) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		textures[i] = 0;
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	array_buffer = 0;
+	// vertex array objects other than the default one are only expected to change through the cache
+	if (get_capabilities().vertex_array_objects) {
+		glBindVertexArray(0);
+	}
+	vertex_array = 0;
+	attributes = &default_attributes;
+	const bool instanced_arrays = get_capabilities().instanced_arrays;
+	for (GLuint index = 0; index < MAX_ATTRIBUTES; ++index) {
+		glDisableVertexAttribArray(index);
+		if (instanced_arrays) {
+			glVertexAttribDivisor(index, 0);
+		}
+		default_attributes.attribute_pointers[index] = AttributePointer {0, 0, 0, 0, nullptr, 0, false};
+		attribute_values[index].valid = false;
+	}
+	default_attributes.enabled_attributes = 0;
+	// the framebuffer binding is kept, only its depth bits are queried again
+	GLint framebuffer_binding = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer_binding);
+	framebuffer = framebuffer_binding;
+	depth_bits = -1;
+}
+
 // Shader
 Shader::Shader(const char* source, GLenum type) {
 	identifier = glCreateShader(type);
@@ -43,6 +182,115 @@ Shader::~Shader() {
 	glDeleteShader(identifier);
 }
 
+// program binary cache (epoxy resolves the core entry points to GL_OES_get_program_binary on GLES 2)
+static bool program_binaries_supported() {
+	static const bool supported = [] {
+		if (epoxy_gl_version() < 30 && !epoxy_has_gl_extension("GL_OES_get_program_binary")) {
+			return false;
+		}
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}();
+	return supported;
+}
+static std::uint64_t hash(std::uint64_t value, const char* string) {
+	// FNV-1a, with the terminating zero included
+	for (const char* c = string; *c; ++c) {
+		value = (value ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+	}
+	return value * 1099511628211ull;
+}
+static bool create_directory(const std::string& directory) {
+	return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+}
+// without a directory that can be created the binaries are quietly not cached
+static std::string get_cache_directory() {
+	std::string directory;
+	// relative paths are invalid and ignored, as the base directory specification demands
+	const char* cache_home = getenv("XDG_CACHE_HOME");
+	if (cache_home && cache_home[0] == '/') {
+		directory = cache_home;
+	}
+	else if (const char* home = getenv("HOME")) {
+		directory = std::string(home) + "/.cache";
+	}
+	else {
+		return std::string();
+	}
+	if (!create_directory(directory)) {
+		return std::string();
+	}
+	directory += "/nitro";
+	if (!create_directory(directory)) {
+		return std::string();
+	}
+	return directory;
+}
+static std::string get_cache_file(std::uint64_t hash) {
+	static const std::string directory = get_cache_directory();
+	if (directory.empty()) {
+		return std::string();
+	}
+	char name[32];
+	std::snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(hash));
+	return directory + name;
+}
+bool Program::load_binary(std::uint64_t hash) {
+	const std::string file_name = get_cache_file(hash);
+	if (file_name.empty()) {
+		return false;
+	}
+	FILE* file = std::fopen(file_name.c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	GLenum format;
+	std::vector<char> binary;
+	bool success = std::fread(&format, sizeof(format), 1, file) == 1;
+	if (success) {
+		char buffer[4096];
+		while (std::size_t length = std::fread(buffer, 1, sizeof(buffer), file)) {
+			binary.insert(binary.end(), buffer, buffer + length);
+		}
+	}
+	std::fclose(file);
+	if (!success || binary.empty()) {
+		return false;
+	}
+	glProgramBinary(identifier, format, binary.data(), binary.size());
+	GLint link_status;
+	glGetProgramiv(identifier, GL_LINK_STATUS, &link_status);
+	return link_status == GL_TRUE;
+}
+void Program::save_binary(std::uint64_t hash) {
+	const std::string file_name = get_cache_file(hash);
+	if (file_name.empty()) {
+		return;
+	}
+	GLint length = 0;
+	glGetProgramiv(identifier, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(identifier, length, &length, &format, binary.data());
+	// write to a temporary file first so that concurrent processes never see a partial binary
+	const std::string temporary_file_name = file_name + "." + std::to_string(getpid());
+	FILE* file = std::fopen(temporary_file_name.c_str(), "wb");
+	if (file == nullptr) {
+		return;
+	}
+	const bool success = std::fwrite(&format, sizeof(format), 1, file) == 1 && std::fwrite(binary.data(), 1, length, file) == static_cast<std::size_t>(length);
+	if (std::fclose(file) == 0 && success) {
+		std::rename(temporary_file_name.c_str(), file_name.c_str());
+	}
+	else {
+		std::remove(temporary_file_name.c_str());
+	}
+}
+
 // Program
 Program::Program() {
 	identifier = glCreateProgram();
@@ -54,10 +302,48 @@ Program::Program(const Shader& vertex_shader, const Shader& fragment_shader): Pr
 	detach_shader(vertex_shader);
 	detach_shader(fragment_shader);
 }
-Program::Program(const char* vertex_shader, const char* fragment_shader): Program(Shader(vertex_shader, GL_VERTEX_SHADER), Shader(fragment_shader, GL_FRAGMENT_SHADER)) {
-
+Program::Program(const char* vertex_shader, const char* fragment_shader, std::initializer_list<const char*> attributes): Program() {
+	const bool cache = program_binaries_supported();
+	std::uint64_t key = 14695981039346656037ull;
+	if (cache) {
+		// the binary depends on the driver, so it is part of the key
+		key = hash(key, vertex_shader);
+		key = hash(key, fragment_shader);
+		for (const char* attribute: attributes) {
+			key = hash(key, attribute);
+		}
+		key = hash(key, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+		key = hash(key, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+		key = hash(key, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+		if (load_binary(key)) {
+			return;
+		}
+	}
+	Shader vertex(vertex_shader, GL_VERTEX_SHADER);
+	Shader fragment(fragment_shader, GL_FRAGMENT_SHADER);
+	attach_shader(vertex);
+	attach_shader(fragment);
+	GLuint index = 0;
+	for (const char* attribute: attributes) {
+		glBindAttribLocation(identifier, index, attribute);
+		++index;
+	}
+	if (cache && epoxy_gl_version() >= 30) {
+		glProgramParameteri(identifier, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	link();
+	detach_shader(vertex);
+	detach_shader(fragment);
+	if (cache) {
+		GLint link_status;
+		glGetProgramiv(identifier, GL_LINK_STATUS, &link_status);
+		if (link_status == GL_TRUE) {
+			save_binary(key);
+		}
+	}
 }
 Program::~Program() {
+	StateCache::forget_program(identifier);
 	glDeleteProgram(identifier);
 }
 void Program::link() {
@@ -82,9 +368,21 @@ GLint Program::get_uniform_location(const char* name) {
 }
 
 // Texture
-Texture::Texture(int width, int height, int depth, const unsigned char* data) {
+Texture::Texture(int width, int height, int depth, const unsigned char* data): opaque(false) {
+	if (depth == 3) {
+		opaque = true;
+	}
+	else if (depth == 4 && data) {
+		opaque = true;
+		for (int i = 3; i < width * height * 4; i += 4) {
+			if (data[i] != 255) {
+				opaque = false;
+				break;
+			}
+		}
+	}
 	glGenTextures(1, &identifier);
-	glBindTexture(GL_TEXTURE_2D, identifier);
+	bind(StateCache::get_active_texture());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -96,29 +394,80 @@ Texture::Texture(int width, int height, int depth, const unsigned char* data) {
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
 	else if (depth == 4)
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	unbind(StateCache::get_active_texture());
 }
 Texture::~Texture() {
+	StateCache::forget_texture(identifier);
 	glDeleteTextures(1, &identifier);
 }
 void Texture::bind(GLenum texture_unit) {
-	glActiveTexture(texture_unit);
-	glBindTexture(GL_TEXTURE_2D, identifier);
+	StateCache::bind_texture(texture_unit, identifier);
 }
 void Texture::unbind(GLenum texture_unit) {
-	glActiveTexture(texture_unit);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	StateCache::bind_texture(texture_unit, 0);
+}
+void Texture::update(int x, int y, int width, int height, int depth, const unsigned char* data) {
+	bind(StateCache::get_active_texture());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	const GLenum format = depth == 1 ? GL_ALPHA : depth == 3 ? GL_RGB : GL_RGBA;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+	unbind(StateCache::get_active_texture());
+}
+
+// StreamBuffer
+StreamBuffer::StreamBuffer(GLsizeiptr size): size(size), offset(0) {
+	buffer.bind();
+	glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+}
+GLint StreamBuffer::write(const GLvoid* data, GLsizei count, GLsizei stride) {
+	const GLsizeiptr length = count * stride;
+	// align the offset to the vertex size so that the vertices can be addressed by index
+	GLsizeiptr start = (offset + stride - 1) / stride * stride;
+	buffer.bind();
+	if (start + length > size) {
+		while (size < length) {
+			size *= 2;
+		}
+		// orphan the old storage, the driver keeps it alive until pending draw calls are done
+		glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		start = 0;
+	}
+	// the range behind the offset is not used by any pending draw call, so it can be written without synchronization
+	void* mapped = nullptr;
+	if (length > 0 && get_capabilities().map_buffer_range) {
+		mapped = glMapBufferRange(GL_ARRAY_BUFFER, start, length, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+	if (mapped) {
+		std::memcpy(mapped, data, length);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	else {
+		glBufferSubData(GL_ARRAY_BUFFER, start, length, data);
+	}
+	offset = start + length;
+	return start / stride;
 }
 
 // FramebufferObject
-FramebufferObject::FramebufferObject(int width, int height): width(width), height(height), texture(new Texture(width, height, 4, nullptr)) {
+FramebufferObject::FramebufferObject(int width, int height, bool depth): width(width), height(height), texture(new Texture(width, height, 4, nullptr)), depth_renderbuffer(0) {
 	glGenFramebuffers(1, &identifier);
 	bind();
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->identifier, 0);
+	if (depth) {
+		glGenRenderbuffers(1, &depth_renderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+	}
 	unbind();
 }
 FramebufferObject::~FramebufferObject() {
+	StateCache::forget_framebuffer(identifier);
 	glDeleteFramebuffers(1, &identifier);
+	if (depth_renderbuffer) {
+		glDeleteRenderbuffers(1, &depth_renderbuffer);
+	}
 }
 void FramebufferObject::use() {
 	bind();
@@ -19,6 +19,11 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include <epoxy/gl.h>
 #include <memory>
+#include <vector>
+#include <initializer_list>
+#include <map>
+#include <cstdint>
+#include <cstring>
 #include <cmath>
 
 namespace gles2 {
@@ -145,6 +150,268 @@ inline const char* error_to_string(GLenum error) {
 	}
 }
 
+// optional features of GLES 3 (or GLES 2 extensions), queried once a context is current
+struct Capabilities {
+	int version;
+	bool vertex_array_objects;
+	bool instanced_arrays;
+	bool map_buffer_range;
+	bool fragment_precision_high;
+};
+
+const Capabilities& get_capabilities();
+
+struct Statistics {
+	unsigned long calls;
+	unsigned long skipped_calls;
+	unsigned long draw_calls;
+};
+
+// remembers the GL state that is touched by draw() and only calls into GL when a value actually changes
+// code that changes this state behind its back has to call invalidate()
+class StateCache {
+	static constexpr int MAX_TEXTURE_UNITS = 8;
+	static constexpr int MAX_ATTRIBUTES = 16;
+	struct AttributePointer {
+		GLuint buffer;
+		GLint size;
+		GLenum type;
+		GLsizei stride;
+		const GLvoid* pointer;
+		GLuint divisor;
+		bool valid;
+	};
+	// the attribute arrays are part of the vertex array object
+	struct Attributes {
+		std::uint32_t enabled_attributes;
+		AttributePointer attribute_pointers[MAX_ATTRIBUTES];
+	};
+	struct Value {
+		GLfloat values[16];
+		bool valid;
+	};
+	static GLuint program;
+	static std::vector<Value>* uniforms;
+	static std::map<GLuint, std::vector<Value>> program_uniforms;
+	static GLenum active_texture;
+	static GLuint textures[MAX_TEXTURE_UNITS];
+	static GLuint array_buffer;
+	static GLuint draw_buffer;
+	static GLuint vertex_array;
+	static GLuint draw_vertex_array;
+	static GLuint framebuffer;
+	// of the bound framebuffer, -1 until it is queried
+	static GLint depth_bits;
+	static Attributes default_attributes;
+	static std::map<GLuint, Attributes> vertex_array_attributes;
+	static Attributes* attributes;
+	static std::uint32_t used_attributes;
+	static Value attribute_values[MAX_ATTRIBUTES];
+	static Statistics statistics;
+	static bool update(Value& cached, const GLfloat* values, int count) {
+		if (cached.valid && std::memcmp(cached.values, values, count * sizeof(GLfloat)) == 0) {
+			++statistics.skipped_calls;
+			return false;
+		}
+		std::memcpy(cached.values, values, count * sizeof(GLfloat));
+		cached.valid = true;
+		++statistics.calls;
+		return true;
+	}
+	static Value* get_uniform(GLint location);
+public:
+	static void use_program(GLuint program) {
+		if (program == StateCache::program) {
+			++statistics.skipped_calls;
+			return;
+		}
+		glUseProgram(program);
+		++statistics.calls;
+		StateCache::program = program;
+		uniforms = &program_uniforms[program];
+	}
+	static void bind_texture(GLenum unit, GLuint texture) {
+		const int index = unit - GL_TEXTURE0;
+		if (index < MAX_TEXTURE_UNITS && textures[index] == texture) {
+			++statistics.skipped_calls;
+			return;
+		}
+		if (unit != active_texture) {
+			glActiveTexture(unit);
+			++statistics.calls;
+			active_texture = unit;
+		}
+		glBindTexture(GL_TEXTURE_2D, texture);
+		++statistics.calls;
+		if (index < MAX_TEXTURE_UNITS) {
+			textures[index] = texture;
+		}
+	}
+	static void bind_buffer(GLuint buffer) {
+		if (buffer == array_buffer) {
+			++statistics.skipped_calls;
+			return;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		++statistics.calls;
+		array_buffer = buffer;
+	}
+	static void bind_vertex_array(GLuint vertex_array) {
+		if (vertex_array == StateCache::vertex_array) {
+			++statistics.skipped_calls;
+			return;
+		}
+		glBindVertexArray(vertex_array);
+		++statistics.calls;
+		StateCache::vertex_array = vertex_array;
+		attributes = vertex_array ? &vertex_array_attributes[vertex_array] : &default_attributes;
+	}
+	static void bind_framebuffer(GLuint framebuffer) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		++statistics.calls;
+		if (framebuffer != StateCache::framebuffer) {
+			StateCache::framebuffer = framebuffer;
+			depth_bits = -1;
+		}
+	}
+	// queried once after the framebuffer changes instead of by every draw that depends on it
+	static GLint get_depth_bits() {
+		if (depth_bits < 0) {
+			glGetIntegerv(GL_DEPTH_BITS, &depth_bits);
+			++statistics.calls;
+		}
+		return depth_bits;
+	}
+	// the buffer that the attribute arrays of the current draw call are sourced from
+	static void set_draw_buffer(GLuint buffer) {
+		draw_buffer = buffer;
+	}
+	// the vertex array object of the current draw call, has to be set before the attribute arrays
+	static void set_draw_vertex_array(GLuint vertex_array) {
+		draw_vertex_array = vertex_array;
+	}
+	static void set_uniform(GLint location, GLint value) {
+		const GLfloat values[] = {static_cast<GLfloat>(value)};
+		Value* cached = get_uniform(location);
+		if (cached && update(*cached, values, 1)) {
+			glUniform1i(location, value);
+		}
+	}
+	static void set_uniform(GLint location, GLfloat value) {
+		Value* cached = get_uniform(location);
+		if (cached && update(*cached, &value, 1)) {
+			glUniform1f(location, value);
+		}
+	}
+	static void set_uniform_vec4(GLint location, const GLfloat* values) {
+		Value* cached = get_uniform(location);
+		if (cached && update(*cached, values, 4)) {
+			glUniform4fv(location, 1, values);
+		}
+	}
+	static void set_uniform_mat4(GLint location, const GLfloat* values) {
+		Value* cached = get_uniform(location);
+		if (cached && update(*cached, values, 16)) {
+			glUniformMatrix4fv(location, 1, GL_FALSE, values);
+		}
+	}
+	static void set_attribute_value(GLint index, const GLfloat* values) {
+		if (index < 0) {
+			// the attribute is not used by the program
+			return;
+		}
+		if (index >= MAX_ATTRIBUTES) {
+			glVertexAttrib4fv(index, values);
+			return;
+		}
+		if (update(attribute_values[index], values, 4)) {
+			glVertexAttrib4fv(index, values);
+		}
+	}
+	static void set_attribute_array(GLuint index, GLint size, GLenum type, GLsizei stride, const GLvoid* pointer, GLuint divisor = 0) {
+		if (static_cast<GLint>(index) < 0) {
+			// the attribute is not used by the program
+			return;
+		}
+		if (draw_vertex_array != vertex_array) {
+			bind_vertex_array(draw_vertex_array);
+		}
+		if (index >= MAX_ATTRIBUTES) {
+			bind_buffer(draw_buffer);
+			glVertexAttribPointer(index, size, type, GL_FALSE, stride, pointer);
+			glEnableVertexAttribArray(index);
+			if (divisor) {
+				glVertexAttribDivisor(index, divisor);
+			}
+			return;
+		}
+		AttributePointer& cached = attributes->attribute_pointers[index];
+		if (cached.valid && cached.buffer == draw_buffer && cached.size == size && cached.type == type && cached.stride == stride && cached.pointer == pointer) {
+			++statistics.skipped_calls;
+		}
+		else {
+			bind_buffer(draw_buffer);
+			glVertexAttribPointer(index, size, type, GL_FALSE, stride, pointer);
+			++statistics.calls;
+			cached = AttributePointer {draw_buffer, size, type, stride, pointer, cached.divisor, true};
+		}
+		if (cached.divisor == divisor) {
+			++statistics.skipped_calls;
+		}
+		else {
+			glVertexAttribDivisor(index, divisor);
+			++statistics.calls;
+			cached.divisor = divisor;
+		}
+		if (attributes->enabled_attributes & (1u << index)) {
+			++statistics.skipped_calls;
+		}
+		else {
+			glEnableVertexAttribArray(index);
+			++statistics.calls;
+			attributes->enabled_attributes |= 1u << index;
+		}
+		used_attributes |= 1u << index;
+		// the current value of an attribute is undefined after it was sourced from an array
+		attribute_values[index].valid = false;
+	}
+	static void begin_draw() {
+		used_attributes = 0;
+		draw_buffer = 0;
+		draw_vertex_array = 0;
+	}
+	static void end_draw() {
+		if (draw_vertex_array != vertex_array) {
+			bind_vertex_array(draw_vertex_array);
+		}
+		// disable the attribute arrays of previous draw calls that are not used by this one
+		const std::uint32_t unused_attributes = attributes->enabled_attributes & ~used_attributes;
+		for (GLuint index = 0; index < MAX_ATTRIBUTES; ++index) {
+			if (unused_attributes & (1u << index)) {
+				glDisableVertexAttribArray(index);
+				++statistics.calls;
+			}
+		}
+		attributes->enabled_attributes &= used_attributes;
+		++statistics.draw_calls;
+	}
+	static GLenum get_active_texture() {
+		return active_texture;
+	}
+	static void forget_program(GLuint program);
+	static void forget_texture(GLuint texture);
+	static void forget_buffer(GLuint buffer);
+	static void forget_vertex_array(GLuint vertex_array);
+	static void forget_framebuffer(GLuint framebuffer);
+	static void invalidate();
+	static const Statistics& get_statistics() {
+		return statistics;
+	}
+	static void reset_statistics() {
+		statistics = Statistics {0, 0, 0};
+	}
+};
+
 class Shader {
 public:
 	GLuint identifier;
@@ -155,11 +422,14 @@ public:
 };
 
 class Program {
+	bool load_binary(std::uint64_t hash);
+	void save_binary(std::uint64_t hash);
 public:
 	GLuint identifier;
 	Program();
 	Program(const Shader& vertex_shader, const Shader& fragment_shader);
-	Program(const char* vertex_shader, const char* fragment_shader);
+	// the attributes are bound to consecutive locations starting at 0
+	Program(const char* vertex_shader, const char* fragment_shader, std::initializer_list<const char*> attributes = {});
 	Program(const Program&) = delete;
 	~Program();
 	Program& operator =(const Program&) = delete;
@@ -171,7 +441,7 @@ public:
 	}
 	void link();
 	void use() {
-		glUseProgram(identifier);
+		StateCache::use_program(identifier);
 	}
 	GLint get_attribute_location(const char* name);
 	GLint get_uniform_location(const char* name);
@@ -180,12 +450,16 @@ public:
 class Texture {
 public:
 	GLuint identifier;
+	// every texel has full alpha
+	bool opaque;
 	Texture(int width, int height, int depth, const unsigned char* data);
 	Texture(const Texture&) = delete;
 	~Texture();
 	Texture& operator =(const Texture&) = delete;
 	void bind(GLenum texture_unit = GL_TEXTURE0);
 	void unbind(GLenum texture_unit = GL_TEXTURE0);
+	// replaces a region of the texture, depth has to be the depth the texture was created with
+	void update(int x, int y, int width, int height, int depth, const unsigned char* data);
 };
 
 class Buffer {
@@ -196,35 +470,89 @@ public:
 	}
 	Buffer(const Buffer&) = delete;
 	~Buffer() {
+		StateCache::forget_buffer(identifier);
 		glDeleteBuffers(1, &identifier);
 	}
 	Buffer& operator =(const Buffer&) = delete;
 	void bind() {
-		glBindBuffer(GL_ARRAY_BUFFER, identifier);
+		StateCache::bind_buffer(identifier);
+	}
+	void unbind() {
+		StateCache::bind_buffer(0);
+	}
+	void set_data(GLsizeiptr size, const GLvoid* data, GLenum usage = GL_STATIC_DRAW) {
+		bind();
+		glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+		unbind();
+	}
+	void set_sub_data(GLintptr offset, GLsizeiptr size, const GLvoid* data) {
+		bind();
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+		unbind();
+	}
+};
+
+class VertexArray {
+public:
+	GLuint identifier;
+	VertexArray() {
+		glGenVertexArrays(1, &identifier);
+	}
+	VertexArray(const VertexArray&) = delete;
+	~VertexArray() {
+		StateCache::forget_vertex_array(identifier);
+		glDeleteVertexArrays(1, &identifier);
+	}
+	VertexArray& operator =(const VertexArray&) = delete;
+	void bind() {
+		StateCache::bind_vertex_array(identifier);
 	}
 	void unbind() {
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		StateCache::bind_vertex_array(0);
+	}
+};
+
+// a vertex buffer for data that changes every frame
+// data is appended until the buffer is full, then the storage is orphaned and writing starts over
+class StreamBuffer {
+	Buffer buffer;
+	GLsizeiptr size;
+	GLsizeiptr offset;
+public:
+	StreamBuffer(GLsizeiptr size = 1 << 20);
+	// copies count vertices into the buffer and returns the index of the first one
+	GLint write(const GLvoid* data, GLsizei count, GLsizei stride);
+	Buffer* get_buffer() {
+		return &buffer;
 	}
 };
 
 class FramebufferObject {
 	int width, height;
 	std::shared_ptr<Texture> texture;
+	// 0 without a depth buffer
+	GLuint depth_renderbuffer;
 public:
 	GLuint identifier;
-	FramebufferObject(int width, int height);
+	FramebufferObject(int width, int height, bool depth = false);
 	FramebufferObject(const FramebufferObject&) = delete;
 	~FramebufferObject();
 	FramebufferObject& operator =(const FramebufferObject&) = delete;
 	std::shared_ptr<Texture> get_texture() const {
 		return texture;
 	}
+	int get_width() const {
+		return width;
+	}
+	int get_height() const {
+		return height;
+	}
 	void use();
 	void bind() {
-		glBindFramebuffer(GL_FRAMEBUFFER, identifier);
+		StateCache::bind_framebuffer(identifier);
 	}
 	void unbind() {
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		StateCache::bind_framebuffer(0);
 	}
 };
 
@@ -237,13 +565,40 @@ public:
 
 	}
 	void enable() const {
-		glActiveTexture(unit);
-		glBindTexture(GL_TEXTURE_2D, identifier);
-		glUniform1i(location, unit - GL_TEXTURE0);
+		StateCache::bind_texture(unit, identifier);
+		StateCache::set_uniform(location, static_cast<GLint>(unit - GL_TEXTURE0));
 	}
 	void disable() const {
-		glActiveTexture(unit);
-		glBindTexture(GL_TEXTURE_2D, 0);
+
+	}
+};
+
+class BufferState {
+	GLuint identifier;
+public:
+	BufferState(Buffer* buffer): identifier(buffer ? buffer->identifier : 0) {
+
+	}
+	void enable() const {
+		StateCache::set_draw_buffer(identifier);
+	}
+	void disable() const {
+
+	}
+};
+
+// has to precede the AttributeArray states of a draw call
+class VertexArrayState {
+	GLuint identifier;
+public:
+	VertexArrayState(VertexArray* vertex_array): identifier(vertex_array ? vertex_array->identifier : 0) {
+
+	}
+	void enable() const {
+		StateCache::set_draw_vertex_array(identifier);
+	}
+	void disable() const {
+
 	}
 };
 
@@ -255,7 +610,7 @@ public:
 
 	}
 	void enable() const {
-		glUniform1f(location, value);
+		StateCache::set_uniform(location, value);
 	}
 	void disable() const {
 
@@ -270,7 +625,7 @@ public:
 
 	}
 	void enable() const {
-		glUniform1i(location, value);
+		StateCache::set_uniform(location, static_cast<GLint>(value));
 	}
 	void disable() const {
 
@@ -285,7 +640,7 @@ public:
 
 	}
 	void enable() const {
-		glUniform4f(location, value[0], value[1], value[2], value[3]);
+		StateCache::set_uniform_vec4(location, value.values);
 	}
 	void disable() const {
 
@@ -300,7 +655,7 @@ public:
 
 	}
 	void enable() const {
-		glUniformMatrix4fv(location, 1, GL_FALSE, value[0].values);
+		StateCache::set_uniform_mat4(location, value[0].values);
 	}
 	void disable() const {
 
@@ -315,7 +670,7 @@ public:
 
 	}
 	void enable() const {
-		glVertexAttrib4f(location, value[0], value[1], value[2], value[3]);
+		StateCache::set_attribute_value(location, value.values);
 	}
 	void disable() const {
 
@@ -327,23 +682,36 @@ class AttributeArray {
 	GLint size;
 	GLenum type;
 	const GLvoid* pointer;
+	GLsizei stride;
+	GLuint divisor;
 public:
-	AttributeArray(GLuint index, GLint size, GLenum type, const GLvoid* pointer): index(index), size(size), type(type), pointer(pointer) {
+	AttributeArray(GLuint index, GLint size, GLenum type, const GLvoid* pointer, GLsizei stride = 0, GLuint divisor = 0): index(index), size(size), type(type), pointer(pointer), stride(stride), divisor(divisor) {
 
 	}
 	void enable() const {
-		glVertexAttribPointer(index, size, type, GL_FALSE, 0, pointer);
-		glEnableVertexAttribArray(index);
+		StateCache::set_attribute_array(index, size, type, stride, pointer, divisor);
 	}
 	void disable() const {
-		glDisableVertexAttribArray(index);
+
 	}
 };
 
-template <class... T> void draw(const Program* program, GLenum mode, GLsizei count, const T&... state) {
-	glUseProgram(program->identifier);
+template <class... T> void draw(const Program* program, GLenum mode, GLint first, GLsizei count, const T&... state) {
+	StateCache::use_program(program->identifier);
+	StateCache::begin_draw();
+	(state.enable(), ...);
+	StateCache::end_draw();
+	glDrawArrays(mode, first, count);
+	(..., state.disable());
+}
+
+// requires get_capabilities().instanced_arrays
+template <class... T> void draw_instanced(const Program* program, GLenum mode, GLint first, GLsizei count, GLsizei instances, const T&... state) {
+	StateCache::use_program(program->identifier);
+	StateCache::begin_draw();
 	(state.enable(), ...);
-	glDrawArrays(mode, 0, count);
+	StateCache::end_draw();
+	glDrawArraysInstanced(mode, first, count, instances);
 	(..., state.disable());
 }
 
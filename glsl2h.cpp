@@ -16,6 +16,8 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 */
 
 #include <fstream>
+#include <sstream>
+#include <string>
 
 constexpr const char* LINE_START = "\t\"";
 constexpr const char* LINE_END = "\\n\"\n";
@@ -40,27 +42,52 @@ public:
 	}
 };
 
+static void write_line(std::ostream& output, const std::string& line) {
+	output << LINE_START;
+	for (char c: line) {
+		if (c == '"' || c == '\\') {
+			output << '\\';
+		}
+		output.put(c);
+	}
+	output << LINE_END;
+}
+
+static void write_source(std::ostream& output, const std::string& source) {
+	std::istringstream input(source);
+	std::string line;
+	while (std::getline(input, line)) {
+		write_line(output, line);
+	}
+	write_line(output, std::string());
+}
+
+// usage: glsl2h input output [DEFINE...]
+// if defines are given, an array with all 2^n combinations of them is generated, bit i of the index corresponds to the i-th define
 int main(int argc, char** argv) {
 	if (argc <= 2) {
 		return 1;
 	}
 	std::ifstream input(argv[1]);
 	std::ofstream output(argv[2]);
-	output << "constexpr const char* " << Name(argv[1]) << " =\n";
-	output << LINE_START;
-	char c;
-	while (input.get(c)) {
-		if (c == '\n') {
-			output << LINE_END;
-			output << LINE_START;
-		}
-		else {
-			if (c == '"' || c == '\\') {
-				output << '\\';
+	std::ostringstream source;
+	source << input.rdbuf();
+	const int defines = argc - 3;
+	if (defines == 0) {
+		output << "constexpr const char* " << Name(argv[1]) << " =\n";
+		write_source(output, source.str());
+		output << ";\n";
+		return 0;
+	}
+	output << "constexpr const char* " << Name(argv[1]) << "[] = {\n";
+	for (int variant = 0; variant < (1 << defines); ++variant) {
+		for (int i = 0; i < defines; ++i) {
+			if (variant & (1 << i)) {
+				write_line(output, std::string("#define ") + argv[3 + i]);
 			}
-			output.put(c);
 		}
+		write_source(output, source.str());
+		output << "\t,\n";
 	}
-	output << LINE_END;
-	output << ";\n";
+	output << "};\n";
 }
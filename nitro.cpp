@@ -19,6 +19,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <vector>
 #include <png.h>
 #include <cstring>
+#include <cmath>
 
 // Texture
 nitro::Texture::Texture() {
@@ -80,7 +81,14 @@ nitro::Texture nitro::Texture::operator *(const Quad& t) const {
 }
 
 // Node
-nitro::Node::Node(): parent(nullptr), x(0.f), y(0.f), width(0.f), height(0.f), scale_x(1.f), scale_y(1.f), mouse_inside(false) {
+static nitro::DrawStatistics draw_statistics;
+const nitro::DrawStatistics& nitro::get_draw_statistics() {
+	return draw_statistics;
+}
+void nitro::reset_draw_statistics() {
+	draw_statistics = DrawStatistics {0, 0};
+}
+nitro::Node::Node(): parent(nullptr), x(0.f), y(0.f), width(0.f), height(0.f), scale_x(1.f), scale_y(1.f), mouse_inside(false), layout_dirty(false), paint_dirty(false), subtree_dirty(false), cached_bounds(0.f, 0.f, 0.f, 0.f), bounds_dirty(true) {
 
 }
 nitro::Node::~Node() {
@@ -90,13 +98,27 @@ nitro::Node* nitro::Node::get_child(std::size_t index) {
 	return nullptr;
 }
 void nitro::Node::prepare_draw() {
+	if (layout_dirty) {
+		layout_dirty = false;
+		layout();
+	}
 	for (int i = 0; Node* node = get_child(i); ++i) {
-		node->prepare_draw();
+		if (node->layout_dirty || node->paint_dirty || node->subtree_dirty) {
+			node->prepare_draw();
+		}
 	}
+	paint_dirty = false;
+	subtree_dirty = false;
 }
 void nitro::Node::draw(const DrawContext& draw_context) {
 	for (int i = 0; Node* node = get_child(i); ++i) {
-		node->draw(DrawContext(draw_context.projection * node->get_transformation().get_matrix()));
+		const DrawContext child_context = draw_context * node->get_transformation();
+		if ((child_context.transformation * node->get_bounds() & draw_context.visible).is_empty()) {
+			++draw_statistics.culled_nodes;
+			continue;
+		}
+		++draw_statistics.drawn_nodes;
+		node->draw(child_context);
 	}
 }
 void nitro::Node::layout() {
@@ -137,11 +159,51 @@ void nitro::Node::mouse_button_release(const Point& point, int button) {
 		child->mouse_button_release(child_point, button);
 	}
 }
+nitro::Rectangle nitro::Node::get_bounds() {
+	if (bounds_dirty) {
+		cached_bounds = Rectangle(0.f, 0.f, width, height);
+		for (int i = 0; Node* child = get_child(i); ++i) {
+			cached_bounds = cached_bounds | child->get_transformation() * child->get_bounds();
+		}
+		bounds_dirty = false;
+	}
+	return cached_bounds;
+}
+void nitro::Node::damage(const Rectangle& rectangle) {
+	if (parent) {
+		parent->damage(get_transformation() * rectangle);
+	}
+}
 void nitro::Node::request_redraw() {
+	paint_dirty = true;
+	invalidate_ancestors(true);
+	damage(get_bounds());
+}
+void nitro::Node::damage_parent() {
+	invalidate_ancestors(false);
 	if (parent) {
-		parent->request_redraw();
+		parent->damage(get_transformation() * get_bounds());
+	}
+}
+void nitro::Node::invalidate_ancestors(bool prepare) {
+	// the flags of the ancestors of a node with a flag set are set as well, so the walk can stop early
+	for (Node* node = parent; node && !(node->bounds_dirty && (node->subtree_dirty || !prepare)); node = node->parent) {
+		node->bounds_dirty = true;
+		node->subtree_dirty = node->subtree_dirty || prepare;
 	}
 }
+void nitro::Node::request_prepare_draw() {
+	paint_dirty = true;
+	invalidate_ancestors(true);
+}
+void nitro::Node::request_layout() {
+	layout_dirty = true;
+	bounds_dirty = true;
+	invalidate_ancestors(true);
+}
+bool nitro::Node::needs_prepare_draw() const {
+	return layout_dirty || paint_dirty || subtree_dirty;
+}
 void nitro::Node::set_parent(Node* parent) {
 	this->parent = parent;
 }
@@ -155,8 +217,9 @@ void nitro::Node::set_location_x(float x) {
 	if (x == this->x) {
 		return;
 	}
+	damage_parent();
 	this->x = x;
-	request_redraw();
+	damage_parent();
 }
 float nitro::Node::get_location_y() const {
 	return y;
@@ -165,8 +228,9 @@ void nitro::Node::set_location_y(float y) {
 	if (y == this->y) {
 		return;
 	}
+	damage_parent();
 	this->y = y;
-	request_redraw();
+	damage_parent();
 }
 float nitro::Node::get_width() const {
 	return width;
@@ -175,8 +239,10 @@ void nitro::Node::set_width(float width) {
 	if (width == this->width) {
 		return;
 	}
+	request_redraw();
 	this->width = width;
-	layout();
+	request_layout();
+	request_redraw();
 }
 float nitro::Node::get_height() const {
 	return height;
@@ -185,40 +251,60 @@ void nitro::Node::set_height(float height) {
 	if (height == this->height) {
 		return;
 	}
+	request_redraw();
 	this->height = height;
-	layout();
+	request_layout();
+	request_redraw();
 }
 float nitro::Node::get_scale_x() const {
 	return scale_x;
 }
 void nitro::Node::set_scale_x(float scale_x) {
+	if (scale_x == this->scale_x) {
+		return;
+	}
+	damage_parent();
 	this->scale_x = scale_x;
+	damage_parent();
 }
 float nitro::Node::get_scale_y() const {
 	return scale_y;
 }
-void nitro::Node::set_scale_y(float scale_x) {
+void nitro::Node::set_scale_y(float scale_y) {
+	if (scale_y == this->scale_y) {
+		return;
+	}
+	damage_parent();
 	this->scale_y = scale_y;
+	damage_parent();
 }
 void nitro::Node::set_location(float x, float y) {
 	if (x == this->x && y == this->y) {
 		return;
 	}
+	damage_parent();
 	this->x = x;
 	this->y = y;
-	request_redraw();
+	damage_parent();
 }
 void nitro::Node::set_size(float width, float height) {
 	if (width == this->width && height == this->height) {
 		return;
 	}
+	request_redraw();
 	this->width = width;
 	this->height = height;
-	layout();
+	request_layout();
+	request_redraw();
 }
 void nitro::Node::set_scale(float scale_x, float scale_y) {
+	if (scale_x == this->scale_x && scale_y == this->scale_y) {
+		return;
+	}
+	damage_parent();
 	this->scale_x = scale_x;
 	this->scale_y = scale_y;
+	damage_parent();
 }
 bool nitro::Node::is_mouse_inside() const {
 	return mouse_inside;
@@ -249,11 +335,17 @@ void nitro::Bin::set_child(Node* child) {
 	if (child == this->child) {
 		return;
 	}
+	if (this->child) {
+		this->child->request_redraw();
+	}
 	this->child = child;
 	if (child) {
 		child->set_parent(this);
 	}
-	layout();
+	request_layout();
+	if (child) {
+		child->request_redraw();
+	}
 }
 
 // SimpleContainer
@@ -266,19 +358,47 @@ nitro::Node* nitro::SimpleContainer::get_child(std::size_t index) {
 void nitro::SimpleContainer::add_child(Node* node) {
 	children.push_back(node);
 	node->set_parent(this);
+	node->request_redraw();
 }
 
 // Window
-nitro::Window::Window(int width, int height): draw_context(gles2::project(width, height)), needs_redraw(false) {
+nitro::Window::Window(int width, int height): render_list(gles2::project(width, height)), draw_context(gles2::project(width, height), Transformation(0.f, 0.f), &render_list), current_damage(0.f, 0.f, 0.f, 0.f) {
 
 }
 void nitro::Window::layout() {
 	draw_context.projection = gles2::project(get_width(), get_height());
+	render_list.set_projection(draw_context.projection);
 	Bin::layout();
 	request_redraw();
 }
-void nitro::Window::request_redraw() {
-	needs_redraw = true;
+void nitro::Window::damage(const Rectangle& rectangle) {
+	// snap to whole pixels so the damage can be used for scissoring
+	const Rectangle pixels = Rectangle(floorf(rectangle.x0), floorf(rectangle.y0), ceilf(rectangle.x1), ceilf(rectangle.y1)) & Rectangle(0.f, 0.f, get_width(), get_height());
+	if (pixels.is_empty()) {
+		return;
+	}
+	current_damage = current_damage.is_empty() ? pixels : current_damage | pixels;
+}
+nitro::Rectangle nitro::Window::get_damage() const {
+	return current_damage;
+}
+nitro::Rectangle nitro::Window::get_repaint_region(int buffer_age) const {
+	if (buffer_age <= 0 || buffer_age - 1 > static_cast<int>(damage_history.size())) {
+		return Rectangle(0.f, 0.f, get_width(), get_height());
+	}
+	Rectangle region = current_damage;
+	for (int i = 0; i < buffer_age - 1; ++i) {
+		region = region | damage_history[i];
+	}
+	return region;
+}
+void nitro::Window::finish_frame() {
+	// keep enough history for triple buffering and then some
+	damage_history.insert(damage_history.begin(), current_damage);
+	if (damage_history.size() > 4) {
+		damage_history.pop_back();
+	}
+	current_damage = Rectangle(0.f, 0.f, 0.f, 0.f);
 }
 void nitro::Window::quit() {
 	running = false;
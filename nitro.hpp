@@ -21,6 +21,9 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include "animation.hpp"
 #include <vector>
 #include <map>
+#include <list>
+#include <string>
+#include <tuple>
 #include <hb.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -119,6 +122,9 @@ public:
 	constexpr Rectangle operator &(const Rectangle& r) const {
 		return Rectangle(max(x0, r.x0), max(y0, r.y0), min(x1, r.x1), min(y1, r.y1));
 	}
+	constexpr bool is_empty() const {
+		return x0 >= x1 || y0 >= y1;
+	}
 };
 
 class Transformation {
@@ -143,6 +149,9 @@ public:
 	constexpr Transformation operator *(const Transformation& t) const {
 		return Transformation(sx * t.tx + tx, sy * t.ty + ty, sx * t.sx, sy * t.sy);
 	}
+	constexpr Rectangle operator *(const Rectangle& r) const {
+		return Rectangle(sx * r.x0 + tx, sy * r.y0 + ty, sx * r.x1 + tx, sy * r.y1 + ty);
+	}
 };
 
 struct Texture {
@@ -156,39 +165,230 @@ struct Texture {
 	Texture operator *(const Quad& t) const;
 };
 
+// blurs a single channel image in place with a Gaussian of standard deviation radius / 3
+void blur(unsigned char* data, int width, int height, int radius);
+
+// a rounded rectangle whose coverage is computed in the fragment shader
+// with a sigma greater than 0 the shape is blurred with a Gaussian of that standard deviation
+struct Shape: Rectangle {
+	float radius;
+	float sigma;
+	constexpr Shape(): Rectangle(0.f, 0.f, 0.f, 0.f), radius(-1.f), sigma(0.f) {}
+	constexpr Shape(float x0, float y0, float x1, float y1, float radius, float sigma = 0.f): Rectangle(x0, y0, x1, y1), radius(radius), sigma(sigma) {}
+	constexpr operator bool() const {
+		return radius >= 0.f;
+	}
+	// shapes need a high precision fragment shader, otherwise mask textures have to be used
+	static bool is_supported();
+};
+
 struct CanvasElement: Rectangle {
 	Color color;
 	Texture texture;
 	float alpha;
 	Texture mask;
 	Texture inverted_mask;
-	CanvasElement(float x0, float y0, float x1, float y1, const Color& color, const Texture& texture, float alpha, const Texture& mask, const Texture& inverted_mask);
+	Shape shape;
+	Shape inverted_shape;
+	CanvasElement(float x0, float y0, float x1, float y1, const Color& color, const Texture& texture, float alpha, const Texture& mask, const Texture& inverted_mask, const Shape& shape = Shape(), const Shape& inverted_shape = Shape());
 	void draw(const gles2::mat4& projection) const;
 };
 
+struct CanvasVertex {
+	GLfloat x, y;
+	// the position in the drawing order, assigned by the RenderList
+	GLfloat depth;
+	// (1, 1, 1, alpha) for textures
+	GLfloat color[4];
+	GLfloat texture_texcoord[2];
+	GLfloat mask_texcoord[2];
+	GLfloat inverted_mask_texcoord[2];
+	// the position relative to the center of the shape and the half size of the shape
+	GLfloat shape[4];
+	GLfloat inverted_shape[4];
+	// radius and sigma of the shape and the inverted shape
+	GLfloat shape_parameters[4];
+};
+
+// everything that selects the shader variant and its textures
+struct CanvasMaterial {
+	gles2::Texture* texture;
+	gles2::Texture* mask;
+	gles2::Texture* inverted_mask;
+	bool shape;
+	bool inverted_shape;
+	bool operator ==(const CanvasMaterial& material) const {
+		return texture == material.texture && mask == material.mask && inverted_mask == material.inverted_mask && shape == material.shape && inverted_shape == material.inverted_shape;
+	}
+	bool operator !=(const CanvasMaterial& material) const {
+		return !(*this == material);
+	}
+	bool operator <(const CanvasMaterial& material) const;
+};
+
+struct CanvasBatch {
+	CanvasMaterial material;
+	GLint first;
+	GLsizei count;
+};
+
+struct DrawContext;
+
 class Canvas {
 	std::vector<CanvasElement> elements;
+	std::vector<CanvasVertex> vertices;
+	std::vector<CanvasBatch> batches;
+	std::shared_ptr<gles2::Buffer> buffer;
+	std::shared_ptr<gles2::VertexArray> vertex_array;
+	bool direct;
+	// the quads of the depth pass of a direct canvas come first, 0 if the canvas was swept
+	GLsizei depth_vertices;
+	std::size_t depth_steps;
+	// the fills of a direct canvas cut into the parts of the sweep of the masks and shapes, drawn in front of their fill
+	struct DirectPart {
+		CanvasElement element;
+		float depth;
+	};
+	std::vector<DirectPart> parts;
+	// the sweep of a direct canvas, built by draw() for framebuffers without enough depth bits
+	mutable std::vector<CanvasVertex> swept_vertices;
+	mutable std::vector<CanvasBatch> swept_batches;
+	// the size and margin passed to prepare()
+	float width, height;
+	float margin;
+	bool resizable;
+	void build();
+	bool prepare_direct();
+	void upload_direct();
+	void prepare_swept() const;
+	void draw_direct(const gles2::mat4& projection) const;
+	void upload_elements();
+	void upload();
 public:
+	Canvas();
 	void clear();
 	void set_color(float x0, float y0, float x1, float y1, const Color& color);
 	void set_texture(float x0, float y0, float x1, float y1, const Texture& texture, float alpha = 1.f);
 	void set_mask(float x0, float y0, float x1, float y1, const Texture& mask);
 	void set_inverted_mask(float x0, float y0, float x1, float y1, const Texture& inverted_mask);
+	void set_shape(float x0, float y0, float x1, float y1, const Shape& shape);
+	void set_inverted_shape(float x0, float y0, float x1, float y1, const Shape& inverted_shape);
+	// a direct canvas skips the sweep in prepare() and resolves overlapping elements with the depth buffer when it is drawn
+	// this is cheaper for canvases that change every frame, without a depth buffer draw() falls back to the sweep
+	void set_direct(bool direct);
 	void prepare();
+	// prepares a canvas for a node of the given size so that resize() can follow size changes without preparing it again
+	// margin is how far the coordinates can be from the edge they follow
+	void prepare(float width, float height, float margin);
+	// nine-slice resize: coordinates within the margin of the left (bottom) edge stay, all others move with the right (top) edge
+	// returns false if that would not give the same result as preparing the canvas again, in that case it has to be rebuilt
+	bool resize(float width, float height);
+	// after prepare() these are the parts of the sweep, unless the canvas is direct
+	const std::vector<CanvasElement>& get_elements() const;
 	void draw(const gles2::mat4& projection) const;
+	void draw(const DrawContext& draw_context) const;
+	// compiles (or loads from the cache) all shader programs so that the first frame does not stall
+	static void load_programs();
+};
+
+// elements that are drawn as they are, in order and without resolving their overlaps, with one draw call per material
+// the tint multiplies the colors of all elements, so changing it does not build the vertices again
+class Mesh {
+	std::vector<CanvasVertex> vertices;
+	std::vector<CanvasBatch> batches;
+	std::unique_ptr<gles2::Buffer> buffer;
+	std::unique_ptr<gles2::VertexArray> vertex_array;
+public:
+	Mesh();
+	void clear();
+	void add(const CanvasElement& element);
+	// uploads the vertices
+	void prepare();
+	void draw(const DrawContext& draw_context, const Color& tint) const;
+};
+
+// collects the primitives of a whole frame and merges them into as few draw calls as possible
+// if there is a depth buffer, opaque primitives are drawn first, front to back and without blending
+class RenderList {
+	struct Batch {
+		CanvasMaterial material;
+		Rectangle bounds;
+		std::vector<CanvasVertex> vertices;
+		Batch(): bounds(0.f, 0.f, 0.f, 0.f) {}
+	};
+	gles2::mat4 projection;
+	std::vector<Batch> batches;
+	std::size_t batch_count;
+	std::vector<Batch> opaque_batches;
+	std::size_t opaque_batch_count;
+	std::vector<CanvasVertex> vertices;
+	unsigned int draw_calls;
+	// 0 if the depth pass is not used
+	GLint depth_bits;
+	unsigned int depth;
+	Batch& get_batch(const CanvasMaterial& material, const Rectangle& bounds);
+	Batch& get_opaque_batch(gles2::Texture* texture);
+	void add(const CanvasMaterial& material, std::vector<CanvasVertex>& vertices);
+public:
+	RenderList(const gles2::mat4& projection);
+	void set_projection(const gles2::mat4& projection);
+	void add(const CanvasElement& element, const Transformation& transformation);
+	void add(const CanvasBatch& batch, const CanvasVertex* vertices, const Transformation& transformation, const gles2::vec4& tint = gles2::vec4(1.f));
+	void flush();
+	// the draw calls are counted across all flushes of a frame, including the ones in the middle of it
+	void begin_frame();
+	unsigned int get_draw_calls() const;
 };
 
 struct DrawContext {
 	gles2::mat4 projection;
-	constexpr DrawContext(const gles2::mat4& projection): projection(projection) {}
+	Transformation transformation;
+	RenderList* render_list;
+	// the part of the render target that is drawn to, nodes outside of it are skipped
+	Rectangle visible;
+	constexpr DrawContext(const gles2::mat4& projection, const Transformation& transformation = Transformation(0.f, 0.f), RenderList* render_list = nullptr, const Rectangle& visible = Rectangle(-INFINITY, -INFINITY, INFINITY, INFINITY)): projection(projection), transformation(transformation), render_list(render_list), visible(visible) {}
+	constexpr DrawContext operator *(const Transformation& t) const {
+		return DrawContext(projection * t.get_matrix(), transformation * t, render_list, visible);
+	}
+	constexpr DrawContext clip(const Rectangle& r) const {
+		return DrawContext(projection, transformation, render_list, visible & r);
+	}
 };
 
+// the children that Node::draw drew and skipped because they were entirely outside the visible rectangle
+struct DrawStatistics {
+	unsigned long drawn_nodes;
+	unsigned long culled_nodes;
+};
+const DrawStatistics& get_draw_statistics();
+void reset_draw_statistics();
+
 class Node {
 	Node* parent;
 	float x, y;
 	float width, height;
 	float scale_x, scale_y;
 	bool mouse_inside;
+	// the size changed and layout() runs in the next prepare_draw()
+	bool layout_dirty;
+	// request_redraw() was called since the last prepare_draw()
+	bool paint_dirty;
+	// some descendant is dirty, prepare_draw() skips children where none of these flags are set
+	bool subtree_dirty;
+	// the bounds of the node and its children without the additions of get_bounds() overrides
+	Rectangle cached_bounds;
+	bool bounds_dirty;
+	// damages the area the node covers in its parent without invalidating its content
+	void damage_parent();
+	// the bounds of the ancestors have to be computed again, if prepare is set prepare_draw() has to visit this node
+	void invalidate_ancestors(bool prepare);
+protected:
+	// defers layout() to the next prepare_draw()
+	void request_layout();
+	// makes the next prepare_draw() visit this node without damaging it
+	void request_prepare_draw();
+	// layout() or prepare_draw() was requested for this node or a descendant
+	bool needs_prepare_draw() const;
 public:
 	Node();
 	virtual ~Node();
@@ -201,7 +401,10 @@ public:
 	virtual void mouse_motion(const Point& point);
 	virtual void mouse_button_press(const Point& point, int button);
 	virtual void mouse_button_release(const Point& point, int button);
-	virtual void request_redraw();
+	// the area the node and its children draw to, in node coordinates
+	virtual Rectangle get_bounds();
+	virtual void damage(const Rectangle& rectangle);
+	void request_redraw();
 	void set_parent(Node* parent);
 	Transformation get_transformation() const;
 	float get_location_x() const;
@@ -247,12 +450,43 @@ struct Glyph {
 	float x, y;
 	float width, height;
 	Glyph(const Texture& texture, float x, float y, float width, float height);
-	void draw(const Color& color, const gles2::mat4& projection) const;
+};
+
+// the glyphs of all fonts are rasterized once and packed into shared atlas textures
+struct GlyphCacheStatistics {
+	unsigned long hits;
+	unsigned long misses;
+	// not affected by reset_glyph_cache_statistics()
+	unsigned long atlas_pages;
+};
+const GlyphCacheStatistics& get_glyph_cache_statistics();
+void reset_glyph_cache_statistics();
+
+// every font keeps the results of its most recently shaped runs
+struct ShapeCacheStatistics {
+	unsigned long hits;
+	unsigned long misses;
+};
+const ShapeCacheStatistics& get_shape_cache_statistics();
+void reset_shape_cache_statistics();
+
+struct ShapedGlyph {
+	unsigned int glyph;
+	int x_offset, y_offset;
+	int x_advance, y_advance;
 };
 
 class Font {
+	using ShapeKey = std::tuple<hb_script_t, hb_direction_t, hb_language_t, std::u32string>;
+	using ShapedRun = std::pair<ShapeKey, std::vector<ShapedGlyph>>;
 	FT_Face face;
 	hb_font_t* hb_font;
+	// keyed by glyph index, the size is fixed per font
+	std::map<unsigned int, Glyph> glyphs;
+	std::map<std::tuple<hb_script_t, hb_direction_t, hb_language_t>, hb_shape_plan_t*> shape_plans;
+	// most recently used first
+	std::list<ShapedRun> shaped_runs;
+	std::map<ShapeKey, std::list<ShapedRun>::iterator> shaped_run_index;
 public:
 	Font(const char* file_name, float size);
 	Font(const Font&) = delete;
@@ -261,6 +495,9 @@ public:
 	float get_descender() const;
 	float get_height() const;
 	Glyph render_glyph(unsigned int glyph);
+	// shapes the text in the buffer, which has to be the given text with its segment properties set
+	// the result is valid until the next call
+	const std::vector<ShapedGlyph>& shape(hb_buffer_t* buffer, const uint32_t* text, std::size_t length);
 	hb_font_t* get_hb_font();
 };
 
@@ -269,7 +506,11 @@ class FontSet {
 	FcFontSet* font_set;
 	FcCharSet* char_set;
 	std::map<int, std::unique_ptr<Font>> fonts;
+	// the font of every character that was looked up, in pages of 256 characters for the BMP
+	std::unique_ptr<Font*[]> bmp_pages[256];
+	std::map<uint32_t, Font*> supplementary_fonts;
 	Font* load_font(int index);
+	Font* find_font(uint32_t character);
 public:
 	FontSet(const char* family, float size);
 	FontSet(const FontSet&) = delete;
@@ -281,11 +522,15 @@ public:
 };
 
 class Text: public Node {
-	std::vector<Glyph> glyphs;
+	// built once with white glyphs, the color is applied when drawing
+	Mesh mesh;
 	Color color;
+	// glyphs can reach outside the node
+	Rectangle glyph_bounds;
 public:
 	Text(FontSet* font, const char* text, const Color& color);
 	void draw(const DrawContext& draw_context) override;
+	Rectangle get_bounds() override;
 	const Color& get_color() const;
 	void set_color(const Color& color);
 };
@@ -314,15 +559,23 @@ public:
 };
 
 class Window: public Bin {
+	RenderList render_list;
 	DrawContext draw_context;
-	bool needs_redraw;
+	// damage of the current frame and of the previous frames (most recent first) in window coordinates
+	Rectangle current_damage;
+	std::vector<Rectangle> damage_history;
 	bool running;
+	void finish_frame();
+protected:
+	Rectangle get_damage() const;
+	// the region that has to be repainted in a back buffer of the given age (0 if unknown)
+	Rectangle get_repaint_region(int buffer_age) const;
 public:
 	Window(int width, int height);
 	virtual int get_fd() = 0;
 	virtual void dispatch_events() = 0;
 	void layout() override;
-	void request_redraw() override;
+	void damage(const Rectangle& rectangle) override;
 	template <class... T> void run(T&... t) {
 		struct pollfd fds[] = {{get_fd(), POLLIN}, {t.get_fd(), POLLIN}...};
 		running = true;
@@ -332,10 +585,18 @@ public:
 			if (!running) {
 				break;
 			}
-			if (Animation::apply_all(1.f / 60.f) || needs_redraw) {
+			// animations are paced by the buffer swap, so they always produce a frame
+			if (Animation::apply_all(1.f / 60.f) && current_damage.is_empty()) {
+				request_redraw();
+			}
+			// deferred layouts damage what they move, so they run before the damage is checked
+			if (!current_damage.is_empty() || needs_prepare_draw()) {
+				render_list.begin_frame();
 				prepare_draw();
+			}
+			if (!current_damage.is_empty()) {
 				draw(draw_context);
-				needs_redraw = false;
+				finish_frame();
 			}
 			else {
 				poll(fds, 1 + sizeof...(T), -1);
@@ -381,6 +642,30 @@ public:
 	void set_alignment(HorizontalAlignment horizontal_alignment, VerticalAlignment vertical_alignment);
 };
 
+// renders its child into a texture once and draws it as a single quad until something inside the child requests a redraw
+// moving or scaling the layer itself does not render it again
+class Layer: public Bin {
+	std::unique_ptr<gles2::FramebufferObject> framebuffer;
+	RenderList render_list;
+	// the part of the layer covered by the framebuffer
+	Rectangle bounds;
+	bool valid;
+	void render();
+public:
+	Layer();
+	void prepare_draw() override;
+	void draw(const DrawContext& draw_context) override;
+	void damage(const Rectangle& rectangle) override;
+};
+
+// the corner masks of the widgets below are shared between all widgets with the same radius and blur radius
+struct MaskCacheStatistics {
+	unsigned long hits;
+	unsigned long misses;
+};
+const MaskCacheStatistics& get_mask_cache_statistics();
+void reset_mask_cache_statistics();
+
 class RoundedRectangle: public Node {
 	Canvas canvas;
 	Color color;
@@ -412,6 +697,7 @@ public:
 	Shadow(const Color& color, float radius, float blur_radius, float x_offset = 0.f, float y_offset = 0.f);
 	void draw(const DrawContext& draw_context) override;
 	void layout() override;
+	Rectangle get_bounds() override;
 };
 
 class InsetShadow: public Node {
@@ -426,4 +712,39 @@ public:
 	void layout() override;
 };
 
+struct RectFieldInstance {
+	Rectangle rectangle;
+	Color color;
+	// the region of the texture of the RectField, in texture coordinates
+	Rectangle texcoord;
+	RectFieldInstance(const Rectangle& rectangle, const Color& color, const Rectangle& texcoord = Rectangle(0.f, 0.f, 1.f, 1.f)): rectangle(rectangle), color(color), texcoord(texcoord) {}
+};
+
+// draws large numbers of rectangles with a single instanced draw call (or a single expanded vertex buffer on GLES 2)
+class RectField: public Node {
+	struct Instance {
+		GLfloat rectangle[4];
+		GLfloat color[4];
+		GLfloat texcoord[4];
+	};
+	std::vector<Instance> instances;
+	std::shared_ptr<gles2::Texture> texture;
+	std::unique_ptr<gles2::Buffer> buffer;
+	std::unique_ptr<gles2::VertexArray> vertex_array;
+	std::size_t buffer_size;
+	std::size_t dirty_begin, dirty_end;
+	// grows with the instances, it is only recomputed by set_instances()
+	Rectangle instance_bounds;
+	void upload();
+public:
+	RectField();
+	void set_instances(const std::vector<RectFieldInstance>& instances);
+	// replaces the instances starting at first, the range has to be within the current instances
+	void update_instances(std::size_t first, const RectFieldInstance* instances, std::size_t count);
+	std::size_t get_instance_count() const;
+	void set_texture(const std::shared_ptr<gles2::Texture>& texture);
+	void draw(const DrawContext& draw_context) override;
+	Rectangle get_bounds() override;
+};
+
 }
@@ -0,0 +1,233 @@
+/*
+
+Copyright (c) 2022, Elias Aebi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nitro.hpp"
+#include <rect_field.fs.glsl.h>
+#include <rect_field.vs.glsl.h>
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+
+class RectFieldProgram: public gles2::Program {
+public:
+	GLint projection_location;
+	GLint texture_location;
+	enum Attribute {
+		CORNER,
+		RECTANGLE,
+		COLOR,
+		TEXCOORD
+	};
+	enum Variant {
+		TEXTURE = 1 << 0,
+		VARIANTS = 1 << 1
+	};
+	RectFieldProgram(int variant): gles2::Program(rect_field_vs_glsl[variant], rect_field_fs_glsl[variant], {"corner", "rectangle", "color", "texcoord"}) {
+		projection_location = get_uniform_location("projection");
+		texture_location = get_uniform_location("texture");
+	}
+	static RectFieldProgram& get(bool texture) {
+		static std::unique_ptr<RectFieldProgram> programs[VARIANTS];
+		const int variant = texture ? TEXTURE : 0;
+		if (!programs[variant]) {
+			programs[variant] = std::make_unique<RectFieldProgram>(variant);
+		}
+		return *programs[variant];
+	}
+};
+
+// the corners of a rectangle as a triangle strip, shared by all instanced draws
+static gles2::Buffer* get_corner_buffer() {
+	static std::unique_ptr<gles2::Buffer> buffer;
+	if (!buffer) {
+		constexpr GLfloat corners[] = {
+			0.f, 0.f,
+			1.f, 0.f,
+			0.f, 1.f,
+			1.f, 1.f
+		};
+		buffer = std::make_unique<gles2::Buffer>();
+		buffer->set_data(sizeof(corners), corners);
+	}
+	return buffer.get();
+}
+
+// without instancing every instance is expanded into two triangles
+struct RectFieldVertex {
+	GLfloat corner[2];
+	GLfloat rectangle[4];
+	GLfloat color[4];
+	GLfloat texcoord[4];
+};
+
+template <class T> static void expand(const T* begin, const T* end, std::vector<RectFieldVertex>& vertices) {
+	constexpr GLfloat corners[6][2] = {{0.f, 0.f}, {1.f, 0.f}, {0.f, 1.f}, {0.f, 1.f}, {1.f, 0.f}, {1.f, 1.f}};
+	vertices.clear();
+	for (const T* instance = begin; instance != end; ++instance) {
+		for (const auto& corner: corners) {
+			vertices.push_back(RectFieldVertex {
+				{corner[0], corner[1]},
+				{instance->rectangle[0], instance->rectangle[1], instance->rectangle[2], instance->rectangle[3]},
+				{instance->color[0], instance->color[1], instance->color[2], instance->color[3]},
+				{instance->texcoord[0], instance->texcoord[1], instance->texcoord[2], instance->texcoord[3]}
+			});
+		}
+	}
+}
+
+static const GLvoid* vertex_offset(std::size_t offset) {
+	return reinterpret_cast<const GLvoid*>(offset);
+}
+
+nitro::RectField::RectField(): buffer_size(0), dirty_begin(0), dirty_end(0), instance_bounds(0.f, 0.f, 0.f, 0.f) {
+
+}
+
+void nitro::RectField::set_instances(const std::vector<RectFieldInstance>& instances) {
+	// the old instances might be outside of the new bounds
+	request_redraw();
+	this->instances.clear();
+	this->instances.resize(instances.size());
+	instance_bounds = Rectangle(0.f, 0.f, 0.f, 0.f);
+	update_instances(0, instances.data(), instances.size());
+}
+
+void nitro::RectField::update_instances(std::size_t first, const RectFieldInstance* instances, std::size_t count) {
+	assert(first + count <= this->instances.size());
+	for (std::size_t i = 0; i < count; ++i) {
+		const RectFieldInstance& instance = instances[i];
+		const gles2::vec4 color = instance.color.unpremultiply();
+		instance_bounds = instance_bounds | instance.rectangle;
+		this->instances[first + i] = Instance {
+			{instance.rectangle.x0, instance.rectangle.y0, instance.rectangle.x1, instance.rectangle.y1},
+			{color[0], color[1], color[2], color[3]},
+			{instance.texcoord.x0, instance.texcoord.y0, instance.texcoord.x1, instance.texcoord.y1}
+		};
+	}
+	if (count > 0) {
+		// updates within a frame are merged into a single upload
+		if (dirty_begin < dirty_end) {
+			dirty_begin = std::min(dirty_begin, first);
+			dirty_end = std::max(dirty_end, first + count);
+		}
+		else {
+			dirty_begin = first;
+			dirty_end = first + count;
+		}
+	}
+	request_redraw();
+}
+
+std::size_t nitro::RectField::get_instance_count() const {
+	return instances.size();
+}
+
+void nitro::RectField::set_texture(const std::shared_ptr<gles2::Texture>& texture) {
+	this->texture = texture;
+	request_redraw();
+}
+
+void nitro::RectField::upload() {
+	const bool instanced = gles2::get_capabilities().instanced_arrays;
+	if (!buffer) {
+		buffer = std::make_unique<gles2::Buffer>();
+		if (gles2::get_capabilities().vertex_array_objects) {
+			vertex_array = std::make_unique<gles2::VertexArray>();
+		}
+	}
+	if (instances.size() != buffer_size) {
+		// the size changed, so the storage is reallocated
+		dirty_begin = 0;
+		dirty_end = instances.size();
+	}
+	if (dirty_begin >= dirty_end) {
+		return;
+	}
+	std::vector<RectFieldVertex> vertices;
+	const Instance* begin = instances.data() + dirty_begin;
+	const Instance* end = instances.data() + dirty_end;
+	if (instanced) {
+		if (instances.size() != buffer_size) {
+			buffer->set_data(instances.size() * sizeof(Instance), instances.data(), GL_DYNAMIC_DRAW);
+		}
+		else {
+			buffer->set_sub_data(dirty_begin * sizeof(Instance), (end - begin) * sizeof(Instance), begin);
+		}
+	}
+	else {
+		expand(begin, end, vertices);
+		if (instances.size() != buffer_size) {
+			buffer->set_data(vertices.size() * sizeof(RectFieldVertex), vertices.data(), GL_DYNAMIC_DRAW);
+		}
+		else {
+			buffer->set_sub_data(dirty_begin * 6 * sizeof(RectFieldVertex), vertices.size() * sizeof(RectFieldVertex), vertices.data());
+		}
+	}
+	buffer_size = instances.size();
+	dirty_begin = 0;
+	dirty_end = 0;
+}
+
+void nitro::RectField::draw(const DrawContext& draw_context) {
+	if (instances.empty()) {
+		return;
+	}
+	// everything that was collected so far is drawn below the rectangles
+	if (draw_context.render_list) {
+		draw_context.render_list->flush();
+	}
+	upload();
+	RectFieldProgram& program = RectFieldProgram::get(texture != nullptr);
+	if (gles2::get_capabilities().instanced_arrays) {
+		gles2::draw_instanced(
+			&program,
+			GL_TRIANGLE_STRIP,
+			0,
+			4,
+			instances.size(),
+			gles2::UniformMat4(program.projection_location, draw_context.projection),
+			gles2::VertexArrayState(vertex_array.get()),
+			gles2::BufferState(get_corner_buffer()),
+			gles2::AttributeArray(RectFieldProgram::CORNER, 2, GL_FLOAT, vertex_offset(0)),
+			gles2::BufferState(buffer.get()),
+			gles2::AttributeArray(RectFieldProgram::RECTANGLE, 4, GL_FLOAT, vertex_offset(offsetof(Instance, rectangle)), sizeof(Instance), 1),
+			gles2::AttributeArray(RectFieldProgram::COLOR, 4, GL_FLOAT, vertex_offset(offsetof(Instance, color)), sizeof(Instance), 1),
+			gles2::AttributeArray(RectFieldProgram::TEXCOORD, 4, GL_FLOAT, vertex_offset(offsetof(Instance, texcoord)), sizeof(Instance), 1),
+			gles2::TextureState(texture.get(), GL_TEXTURE0, program.texture_location)
+		);
+	}
+	else {
+		gles2::draw(
+			&program,
+			GL_TRIANGLES,
+			0,
+			instances.size() * 6,
+			gles2::UniformMat4(program.projection_location, draw_context.projection),
+			gles2::VertexArrayState(vertex_array.get()),
+			gles2::BufferState(buffer.get()),
+			gles2::AttributeArray(RectFieldProgram::CORNER, 2, GL_FLOAT, vertex_offset(offsetof(RectFieldVertex, corner)), sizeof(RectFieldVertex)),
+			gles2::AttributeArray(RectFieldProgram::RECTANGLE, 4, GL_FLOAT, vertex_offset(offsetof(RectFieldVertex, rectangle)), sizeof(RectFieldVertex)),
+			gles2::AttributeArray(RectFieldProgram::COLOR, 4, GL_FLOAT, vertex_offset(offsetof(RectFieldVertex, color)), sizeof(RectFieldVertex)),
+			gles2::AttributeArray(RectFieldProgram::TEXCOORD, 4, GL_FLOAT, vertex_offset(offsetof(RectFieldVertex, texcoord)), sizeof(RectFieldVertex)),
+			gles2::TextureState(texture.get(), GL_TEXTURE0, program.texture_location)
+		);
+	}
+}
+
+nitro::Rectangle nitro::RectField::get_bounds() {
+	return Node::get_bounds() | instance_bounds;
+}
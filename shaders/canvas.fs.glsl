@@ -1,30 +1,97 @@
 precision mediump float;
 
-uniform bool use_texture;
-uniform bool use_mask;
-uniform bool use_inverted_mask;
+#if defined(USE_SHAPE) || defined(USE_INVERTED_SHAPE)
+// shapes are evaluated in pixels, which needs more than mediump
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#endif
+varying vec4 v_shape_parameters;
+// the coverage of a pixel by a rounded rectangle, from the signed distance to its edge
+float rounded_rectangle(vec4 shape, float radius) {
+	vec2 q = abs(shape.xy) - shape.zw + radius;
+	float distance = length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - radius;
+	return clamp(0.5 - distance, 0.0, 1.0);
+}
+vec2 approximate_erf(vec2 x) {
+	vec2 s = sign(x);
+	vec2 a = abs(x);
+	x = 1.0 + (0.278393 + (0.230389 + 0.078108 * (a * a)) * a) * a;
+	x *= x;
+	return s - s / (x * x);
+}
+float gaussian(float x, float sigma) {
+	return exp(-(x * x) / (2.0 * sigma * sigma)) / (2.506628275 * sigma);
+}
+// the blurred coverage of a horizontal line through a rounded rectangle, the blur along x is solved with erf
+float blurred_rounded_rectangle_row(float x, float y, vec2 half_size, float radius, float sigma) {
+	float delta = min(half_size.y - radius - abs(y), 0.0);
+	float curved = half_size.x - radius + sqrt(max(0.0, radius * radius - delta * delta));
+	vec2 integral = 0.5 + 0.5 * approximate_erf((x + vec2(-curved, curved)) * (0.707106781 / sigma));
+	return integral.y - integral.x;
+}
+// the blur along y is integrated numerically over 3 sigma
+// 8 rows keep the error below 2% where a large radius curves within a small blur, 4 rows reached 3%
+float blurred_rounded_rectangle(vec4 shape, float radius, float sigma) {
+	float start = clamp(-3.0 * sigma, shape.y - shape.w, shape.y + shape.w);
+	float end = clamp(3.0 * sigma, shape.y - shape.w, shape.y + shape.w);
+	float step = (end - start) / 8.0;
+	float y = start + step * 0.5;
+	float value = 0.0;
+	for (int i = 0; i < 8; ++i) {
+		value += blurred_rounded_rectangle_row(shape.x, shape.y - y, shape.zw, radius, sigma) * gaussian(y, sigma) * step;
+		y += step;
+	}
+	return value;
+}
+float shape_coverage(vec4 shape, vec2 parameters) {
+	if (parameters.y > 0.0) {
+		return blurred_rounded_rectangle(shape, parameters.x, parameters.y);
+	}
+	return rounded_rectangle(shape, parameters.x);
+}
+#endif
+
+varying vec4 v_color;
 
+#ifdef USE_TEXTURE
 uniform sampler2D texture;
-uniform float alpha;
+varying vec2 v_texture_texcoord;
+#endif
+
+#ifdef USE_MASK
 uniform sampler2D mask;
+varying vec2 v_mask_texcoord;
+#endif
+
+#ifdef USE_INVERTED_MASK
 uniform sampler2D inverted_mask;
+varying vec2 v_inverted_mask_texcoord;
+#endif
 
-varying vec4 v_color;
-varying vec4 v_texture_texcoord;
-varying vec4 v_mask_texcoord;
-varying vec4 v_inverted_mask_texcoord;
+#ifdef USE_SHAPE
+varying vec4 v_shape;
+#endif
+
+#ifdef USE_INVERTED_SHAPE
+varying vec4 v_inverted_shape;
+#endif
 
 void main() {
-	if (use_texture) {
-		gl_FragColor = texture2D(texture, v_texture_texcoord.xy) * vec4(1.0, 1.0, 1.0, alpha);
-	}
-	else {
-		gl_FragColor = v_color;
-	}
-	if (use_mask) {
-		gl_FragColor *= vec4(1.0, 1.0, 1.0, texture2D(mask, v_mask_texcoord.xy).a);
-	}
-	if (use_inverted_mask) {
-		gl_FragColor *= vec4(1.0, 1.0, 1.0, 1.0 - texture2D(inverted_mask, v_inverted_mask_texcoord.xy).a);
-	}
+#ifdef USE_TEXTURE
+	gl_FragColor = texture2D(texture, v_texture_texcoord) * v_color;
+#else
+	gl_FragColor = v_color;
+#endif
+#ifdef USE_MASK
+	gl_FragColor *= vec4(1.0, 1.0, 1.0, texture2D(mask, v_mask_texcoord).a);
+#endif
+#ifdef USE_INVERTED_MASK
+	gl_FragColor *= vec4(1.0, 1.0, 1.0, 1.0 - texture2D(inverted_mask, v_inverted_mask_texcoord).a);
+#endif
+#ifdef USE_SHAPE
+	gl_FragColor *= vec4(1.0, 1.0, 1.0, shape_coverage(v_shape, v_shape_parameters.xy));
+#endif
+#ifdef USE_INVERTED_SHAPE
+	gl_FragColor *= vec4(1.0, 1.0, 1.0, 1.0 - shape_coverage(v_inverted_shape, v_shape_parameters.zw));
+#endif
 }
@@ -1,20 +1,63 @@
 uniform mat4 projection;
-attribute vec4 vertex;
-
+uniform float depth_scale;
+// multiplies the color of every vertex
+uniform vec4 tint;
+// the third component is the position in the drawing order
+attribute vec3 vertex;
 attribute vec4 color;
-attribute vec4 texture_texcoord;
-attribute vec4 mask_texcoord;
-attribute vec4 inverted_mask_texcoord;
-
 varying vec4 v_color;
-varying vec4 v_texture_texcoord;
-varying vec4 v_mask_texcoord;
-varying vec4 v_inverted_mask_texcoord;
+
+#ifdef USE_TEXTURE
+attribute vec2 texture_texcoord;
+varying vec2 v_texture_texcoord;
+#endif
+
+#ifdef USE_MASK
+attribute vec2 mask_texcoord;
+varying vec2 v_mask_texcoord;
+#endif
+
+#ifdef USE_INVERTED_MASK
+attribute vec2 inverted_mask_texcoord;
+varying vec2 v_inverted_mask_texcoord;
+#endif
+
+#ifdef USE_SHAPE
+attribute vec4 shape;
+varying vec4 v_shape;
+#endif
+
+#ifdef USE_INVERTED_SHAPE
+attribute vec4 inverted_shape;
+varying vec4 v_inverted_shape;
+#endif
+
+#if defined(USE_SHAPE) || defined(USE_INVERTED_SHAPE)
+attribute vec4 shape_parameters;
+varying vec4 v_shape_parameters;
+#endif
 
 void main() {
-	gl_Position = projection * vertex;
-	v_color = color;
+	gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
+	// primitives that are added later are closer
+	gl_Position.z = (1.0 - (vertex.z + 1.0) * depth_scale) * gl_Position.w;
+	v_color = color * tint;
+#ifdef USE_TEXTURE
 	v_texture_texcoord = texture_texcoord;
+#endif
+#ifdef USE_MASK
 	v_mask_texcoord = mask_texcoord;
+#endif
+#ifdef USE_INVERTED_MASK
 	v_inverted_mask_texcoord = inverted_mask_texcoord;
+#endif
+#ifdef USE_SHAPE
+	v_shape = shape;
+#endif
+#ifdef USE_INVERTED_SHAPE
+	v_inverted_shape = inverted_shape;
+#endif
+#if defined(USE_SHAPE) || defined(USE_INVERTED_SHAPE)
+	v_shape_parameters = shape_parameters;
+#endif
 }
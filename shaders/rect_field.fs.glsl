@@ -0,0 +1,16 @@
+precision mediump float;
+
+varying vec4 v_color;
+
+#ifdef USE_TEXTURE
+uniform sampler2D texture;
+varying vec2 v_texcoord;
+#endif
+
+void main() {
+#ifdef USE_TEXTURE
+	gl_FragColor = texture2D(texture, v_texcoord) * v_color;
+#else
+	gl_FragColor = v_color;
+#endif
+}
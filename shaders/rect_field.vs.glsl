@@ -0,0 +1,18 @@
+uniform mat4 projection;
+attribute vec2 corner;
+attribute vec4 rectangle;
+attribute vec4 color;
+varying vec4 v_color;
+
+#ifdef USE_TEXTURE
+attribute vec4 texcoord;
+varying vec2 v_texcoord;
+#endif
+
+void main() {
+	gl_Position = projection * vec4(mix(rectangle.xy, rectangle.zw, corner), 0.0, 1.0);
+	v_color = color;
+#ifdef USE_TEXTURE
+	v_texcoord = mix(texcoord.xy, texcoord.zw, corner);
+#endif
+}
@@ -17,27 +17,238 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include "nitro.hpp"
 #include <hb-ft.h>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-static hb_codepoint_t utf8_get_next(const char*& c) {
-	hb_codepoint_t result = 0;
-	if ((c[0] & 0x80) == 0x00) {
-		result = c[0];
-		c += 1;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// the bytes of a block of 16 bytes by their role in UTF-8, one bit per byte
+struct Utf8Block {
+	unsigned int high;
+	unsigned int continuation;
+	unsigned int lead2, lead3, lead4;
+	// E0, ED, F0 and F4 followed by a byte outside the narrower range of their first continuation byte
+	unsigned int restricted;
+};
+
+#if defined(__SSE2__)
+// widens the block if it is all ASCII
+static bool decode_ascii_block(const unsigned char* c, uint32_t* result) {
+	const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c));
+	if (_mm_movemask_epi8(bytes) != 0) {
+		return false;
 	}
-	else if ((c[0] & 0xE0) == 0xC0) {
-		result = (c[0] & 0x1F) << 6 | (c[1] & 0x3F);
-		c += 2;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+	const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(result), _mm_unpacklo_epi16(low, zero));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 4), _mm_unpackhi_epi16(low, zero));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 8), _mm_unpacklo_epi16(high, zero));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 12), _mm_unpackhi_epi16(high, zero));
+	return true;
+}
+static Utf8Block classify_utf8_block(const unsigned char* c) {
+	const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c));
+	// the byte after every byte, the last one is followed by 0
+	const __m128i next = _mm_srli_si128(bytes, 1);
+	// SSE2 has no unsigned comparison, but clamping to the range leaves exactly the bytes within it unchanged
+	auto in_range = [](__m128i bytes, unsigned char lower, unsigned char upper) {
+		const __m128i clamped = _mm_min_epu8(_mm_max_epu8(bytes, _mm_set1_epi8(lower)), _mm_set1_epi8(upper));
+		return _mm_cmpeq_epi8(clamped, bytes);
+	};
+	auto equal = [&](unsigned char byte) {
+		return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(byte));
+	};
+	const __m128i next_below_a0 = in_range(next, 0x00, 0x9F);
+	const __m128i next_below_90 = in_range(next, 0x00, 0x8F);
+	const __m128i restricted = _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(equal(0xE0), next_below_a0), _mm_andnot_si128(next_below_a0, equal(0xED))),
+		_mm_or_si128(_mm_and_si128(equal(0xF0), next_below_90), _mm_andnot_si128(next_below_90, equal(0xF4)))
+	);
+	return Utf8Block {
+		static_cast<unsigned int>(_mm_movemask_epi8(bytes)),
+		static_cast<unsigned int>(_mm_movemask_epi8(in_range(bytes, 0x80, 0xBF))),
+		static_cast<unsigned int>(_mm_movemask_epi8(in_range(bytes, 0xC2, 0xDF))),
+		static_cast<unsigned int>(_mm_movemask_epi8(in_range(bytes, 0xE0, 0xEF))),
+		static_cast<unsigned int>(_mm_movemask_epi8(in_range(bytes, 0xF0, 0xF4))),
+		static_cast<unsigned int>(_mm_movemask_epi8(restricted))
+	};
+}
+#elif defined(__ARM_NEON)
+// NEON has no movemask, every byte keeps the bit of its position and the bits are added up pairwise
+static unsigned int movemask(uint8x16_t mask) {
+	static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(mask, vld1q_u8(bits)))));
+	return vgetq_lane_u64(sums, 0) | vgetq_lane_u64(sums, 1) << 8;
+}
+// widens the block if it is all ASCII
+static bool decode_ascii_block(const unsigned char* c, uint32_t* result) {
+	const uint8x16_t bytes = vld1q_u8(c);
+	const uint64x2_t high = vreinterpretq_u64_u8(vandq_u8(bytes, vdupq_n_u8(0x80)));
+	if ((vgetq_lane_u64(high, 0) | vgetq_lane_u64(high, 1)) != 0) {
+		return false;
 	}
-	else if ((c[0] & 0xF0) == 0xE0) {
-		result = (c[0] & 0x0F) << 12 | (c[1] & 0x3F) << 6 | (c[2] & 0x3F);
-		c += 3;
+	const uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+	const uint16x8_t high16 = vmovl_u8(vget_high_u8(bytes));
+	vst1q_u32(result, vmovl_u16(vget_low_u16(low)));
+	vst1q_u32(result + 4, vmovl_u16(vget_high_u16(low)));
+	vst1q_u32(result + 8, vmovl_u16(vget_low_u16(high16)));
+	vst1q_u32(result + 12, vmovl_u16(vget_high_u16(high16)));
+	return true;
+}
+static Utf8Block classify_utf8_block(const unsigned char* c) {
+	const uint8x16_t bytes = vld1q_u8(c);
+	// the byte after every byte, the last one is followed by 0
+	const uint8x16_t next = vextq_u8(bytes, vdupq_n_u8(0), 1);
+	auto in_range = [](uint8x16_t bytes, unsigned char lower, unsigned char upper) {
+		return vandq_u8(vcgeq_u8(bytes, vdupq_n_u8(lower)), vcleq_u8(bytes, vdupq_n_u8(upper)));
+	};
+	auto equal = [&](unsigned char byte) {
+		return vceqq_u8(bytes, vdupq_n_u8(byte));
+	};
+	const uint8x16_t next_below_a0 = vcleq_u8(next, vdupq_n_u8(0x9F));
+	const uint8x16_t next_below_90 = vcleq_u8(next, vdupq_n_u8(0x8F));
+	const uint8x16_t restricted = vorrq_u8(
+		vorrq_u8(vandq_u8(equal(0xE0), next_below_a0), vbicq_u8(equal(0xED), next_below_a0)),
+		vorrq_u8(vandq_u8(equal(0xF0), next_below_90), vbicq_u8(equal(0xF4), next_below_90))
+	);
+	return Utf8Block {
+		movemask(vcgeq_u8(bytes, vdupq_n_u8(0x80))),
+		movemask(in_range(bytes, 0x80, 0xBF)),
+		movemask(in_range(bytes, 0xC2, 0xDF)),
+		movemask(in_range(bytes, 0xE0, 0xEF)),
+		movemask(in_range(bytes, 0xF0, 0xF4)),
+		movemask(restricted)
+	};
+}
+#endif
+
+// the number of bytes at the start of the block that are well-formed sequences, up to the first sequence that continues past the block
+// 0 if there is an ill-formed sequence before that, the scalar decoder then takes over
+static int get_valid_utf8_length(const Utf8Block& block) {
+	const unsigned int crossing = (block.lead2 & 0x8000) | (block.lead3 & 0xC000) | (block.lead4 & 0xE000);
+	const int length = crossing ? __builtin_ctz(crossing) : 16;
+	const unsigned int prefix = (1u << length) - 1;
+	const unsigned int lead2 = block.lead2 & prefix;
+	const unsigned int lead3 = block.lead3 & prefix;
+	const unsigned int lead4 = block.lead4 & prefix;
+	// every byte above 0x7F is either a lead byte or one of the continuation bytes it needs
+	const unsigned int expected = (lead2 | lead3 | lead4) << 1 | (lead3 | lead4) << 2 | lead4 << 3;
+	const unsigned int invalid = block.high & ~block.continuation & ~(lead2 | lead3 | lead4);
+	if (((block.continuation ^ expected) & prefix) != 0 || (expected & ~prefix) != 0 || ((invalid | block.restricted) & prefix) != 0) {
+		return 0;
 	}
-	else if ((c[0] & 0xF8) == 0xF0) {
-		result = (c[0] & 0x07) << 18 | (c[1] & 0x3F) << 12 | (c[2] & 0x3F) << 6 | (c[3] & 0x3F);
-		c += 4;
+	return length;
+}
+
+// decodes sequences that are known to be well-formed
+static uint32_t* decode_valid_utf8(const unsigned char* c, const unsigned char* end, uint32_t* result) {
+	while (c < end) {
+		if (c[0] < 0x80) {
+			*result++ = c[0];
+			c += 1;
+		}
+		else if (c[0] < 0xE0) {
+			*result++ = (c[0] & 0x1F) << 6 | (c[1] & 0x3F);
+			c += 2;
+		}
+		else if (c[0] < 0xF0) {
+			*result++ = (c[0] & 0x0F) << 12 | (c[1] & 0x3F) << 6 | (c[2] & 0x3F);
+			c += 3;
+		}
+		else {
+			*result++ = (c[0] & 0x07) << 18 | (c[1] & 0x3F) << 12 | (c[2] & 0x3F) << 6 | (c[3] & 0x3F);
+			c += 4;
+		}
 	}
 	return result;
 }
+#endif
+
+// decodes a whole string, every ill-formed subsequence becomes U+FFFD
+static void utf8_decode(const char* text, std::size_t length, std::vector<uint32_t>& codepoints) {
+	const unsigned char* c = reinterpret_cast<const unsigned char*>(text);
+	// there are never more codepoints than bytes
+	codepoints.resize(length);
+	uint32_t* result = codepoints.data();
+	std::size_t i = 0;
+	while (i < length) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+		// 16 bytes at a time, ASCII is widened directly and other blocks are validated as a whole before they are decoded
+		if (i + 16 <= length) {
+			if (decode_ascii_block(c + i, result)) {
+				result += 16;
+				i += 16;
+				continue;
+			}
+			const int valid_length = get_valid_utf8_length(classify_utf8_block(c + i));
+			if (valid_length > 0) {
+				result = decode_valid_utf8(c + i, c + i + valid_length, result);
+				i += valid_length;
+				continue;
+			}
+		}
+#else
+		// ASCII fast path, 8 bytes at a time
+		if (i + 8 <= length) {
+			uint64_t word;
+			std::memcpy(&word, c + i, 8);
+			if ((word & 0x8080808080808080) == 0) {
+				for (int j = 0; j < 8; ++j) {
+					result[j] = c[i + j];
+				}
+				result += 8;
+				i += 8;
+				continue;
+			}
+		}
+#endif
+		if (c[i] < 0x80) {
+			*result++ = c[i++];
+			continue;
+		}
+		// the range of the first continuation byte excludes overlong forms, surrogates and values above U+10FFFF
+		int count;
+		uint32_t codepoint;
+		unsigned char lower = 0x80, upper = 0xBF;
+		if (c[i] >= 0xC2 && c[i] <= 0xDF) {
+			count = 1;
+			codepoint = c[i] & 0x1F;
+		}
+		else if (c[i] >= 0xE0 && c[i] <= 0xEF) {
+			count = 2;
+			codepoint = c[i] & 0x0F;
+			if (c[i] == 0xE0) lower = 0xA0;
+			else if (c[i] == 0xED) upper = 0x9F;
+		}
+		else if (c[i] >= 0xF0 && c[i] <= 0xF4) {
+			count = 3;
+			codepoint = c[i] & 0x07;
+			if (c[i] == 0xF0) lower = 0x90;
+			else if (c[i] == 0xF4) upper = 0x8F;
+		}
+		else {
+			*result++ = 0xFFFD;
+			++i;
+			continue;
+		}
+		std::size_t j = i + 1;
+		for (; j <= i + count && j < length; ++j) {
+			if (c[j] < lower || c[j] > upper) {
+				break;
+			}
+			codepoint = codepoint << 6 | (c[j] & 0x3F);
+			lower = 0x80;
+			upper = 0xBF;
+		}
+		*result++ = j == i + count + 1 ? codepoint : 0xFFFD;
+		i = j;
+	}
+	codepoints.resize(result - codepoints.data());
+}
 
 static bool script_is_real(hb_script_t script) {
 	return script != HB_SCRIPT_COMMON && script != HB_SCRIPT_INHERITED && script != HB_SCRIPT_UNKNOWN;
@@ -50,11 +261,93 @@ static bool compare_scripts(hb_script_t script1, hb_script_t script2) {
 nitro::Glyph::Glyph(const Texture& texture, float x, float y, float width, float height): texture(texture), x(x), y(y), width(width), height(height) {
 
 }
-void nitro::Glyph::draw(const Color& color, const gles2::mat4& projection) const {
-	CanvasElement(x, y, x + width, y + height, color, Texture(), 0.f, texture, Texture()).draw(projection);
+
+// GlyphAtlas
+static nitro::GlyphCacheStatistics glyph_cache_statistics;
+// every page is divided into shelves, a glyph goes to the tightest shelf it fits in
+class GlyphAtlas {
+	static constexpr int PAGE_SIZE = 1024;
+	// glyphs are kept apart so that linear filtering does not pick up their neighbors
+	static constexpr int PADDING = 1;
+	struct Shelf {
+		int y;
+		int height;
+		int width;
+	};
+	struct Page {
+		std::shared_ptr<gles2::Texture> texture;
+		std::vector<Shelf> shelves;
+		int height;
+	};
+	std::vector<Page> pages;
+	static bool insert(Page& page, int width, int height, int& x, int& y);
+public:
+	nitro::Texture add(int width, int height, int pitch, const unsigned char* data);
+};
+bool GlyphAtlas::insert(Page& page, int width, int height, int& x, int& y) {
+	Shelf* best = nullptr;
+	for (Shelf& shelf: page.shelves) {
+		// shelves that are much higher than the glyph would waste space
+		if (shelf.height >= height && shelf.height <= height + height / 4 + 2 && PAGE_SIZE - shelf.width >= width) {
+			if (best == nullptr || shelf.height < best->height) {
+				best = &shelf;
+			}
+		}
+	}
+	if (best == nullptr) {
+		if (PAGE_SIZE - page.height < height) {
+			return false;
+		}
+		page.shelves.push_back(Shelf {page.height, height, 0});
+		page.height += height;
+		best = &page.shelves.back();
+	}
+	x = best->width;
+	y = best->y;
+	best->width += width;
+	return true;
+}
+nitro::Texture GlyphAtlas::add(int width, int height, int pitch, const unsigned char* data) {
+	static std::vector<unsigned char> buffer;
+	buffer.resize(width * height);
+	// the rows of the bitmap go from top to bottom
+	for (int i = 0; i < height; ++i) {
+		std::copy(data + i * pitch, data + i * pitch + width, buffer.data() + i * width);
+	}
+	if (width + PADDING > PAGE_SIZE || height + PADDING > PAGE_SIZE) {
+		return nitro::Texture::create_from_data(width, height, 1, buffer.data(), true);
+	}
+	int x, y;
+	if (pages.empty() || !insert(pages.back(), width + PADDING, height + PADDING, x, y)) {
+		const std::vector<unsigned char> empty(PAGE_SIZE * PAGE_SIZE);
+		pages.push_back(Page {std::make_shared<gles2::Texture>(PAGE_SIZE, PAGE_SIZE, 1, empty.data()), {}, 0});
+		++glyph_cache_statistics.atlas_pages;
+		insert(pages.back(), width + PADDING, height + PADDING, x, y);
+	}
+	const Page& page = pages.back();
+	page.texture->update(x, y, width, height, 1, buffer.data());
+	const float size = PAGE_SIZE;
+	return nitro::Texture(page.texture, nitro::Quad(x / size, (y + height) / size, (x + width) / size, y / size));
+}
+static GlyphAtlas glyph_atlas;
+const nitro::GlyphCacheStatistics& nitro::get_glyph_cache_statistics() {
+	return glyph_cache_statistics;
+}
+void nitro::reset_glyph_cache_statistics() {
+	glyph_cache_statistics.hits = 0;
+	glyph_cache_statistics.misses = 0;
 }
 
 // Font
+static constexpr std::size_t SHAPED_RUN_CACHE_SIZE = 256;
+static nitro::ShapeCacheStatistics shape_cache_statistics;
+const nitro::ShapeCacheStatistics& nitro::get_shape_cache_statistics() {
+	return shape_cache_statistics;
+}
+void nitro::reset_shape_cache_statistics() {
+	shape_cache_statistics.hits = 0;
+	shape_cache_statistics.misses = 0;
+}
 static FT_Library initialize_freetype() {
 	FT_Library library;
 	FT_Init_FreeType(&library);
@@ -67,6 +360,9 @@ nitro::Font::Font(const char* file_name, float size) {
 	hb_font = hb_ft_font_create(face, nullptr);
 }
 nitro::Font::~Font() {
+	for (auto& shape_plan: shape_plans) {
+		hb_shape_plan_destroy(shape_plan.second);
+	}
 	hb_font_destroy(hb_font);
 	FT_Done_Face(face);
 }
@@ -77,10 +373,54 @@ float nitro::Font::get_height() const {
 	return get_descender() + (face->size->metrics.ascender >> 6);
 }
 nitro::Glyph nitro::Font::render_glyph(unsigned int glyph) {
+	auto iterator = glyphs.find(glyph);
+	if (iterator != glyphs.end()) {
+		++glyph_cache_statistics.hits;
+		return iterator->second;
+	}
+	++glyph_cache_statistics.misses;
 	FT_Load_Glyph(face, glyph, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT);
 	FT_Bitmap* bitmap = &face->glyph->bitmap;
-	Texture texture = Texture::create_from_data(bitmap->width, bitmap->rows, 1, bitmap->buffer, true);
-	return Glyph(texture, face->glyph->bitmap_left, face->glyph->bitmap_top - static_cast<int>(bitmap->rows), bitmap->width, bitmap->rows);
+	const int width = bitmap->width;
+	const int height = bitmap->rows;
+	// empty glyphs like spaces do not need a texture
+	const Texture texture = width > 0 && height > 0 ? glyph_atlas.add(width, height, bitmap->pitch, bitmap->buffer) : Texture();
+	const Glyph result(texture, face->glyph->bitmap_left, face->glyph->bitmap_top - height, width, height);
+	glyphs.emplace(glyph, result);
+	return result;
+}
+const std::vector<nitro::ShapedGlyph>& nitro::Font::shape(hb_buffer_t* buffer, const uint32_t* text, std::size_t length) {
+	hb_segment_properties_t properties;
+	hb_buffer_get_segment_properties(buffer, &properties);
+	ShapeKey key(properties.script, properties.direction, properties.language, std::u32string(text, text + length));
+	auto iterator = shaped_run_index.find(key);
+	if (iterator != shaped_run_index.end()) {
+		++shape_cache_statistics.hits;
+		shaped_runs.splice(shaped_runs.begin(), shaped_runs, iterator->second);
+		return iterator->second->second;
+	}
+	++shape_cache_statistics.misses;
+	// the face would look the plan up again for every run
+	hb_shape_plan_t*& shape_plan = shape_plans[std::make_tuple(properties.script, properties.direction, properties.language)];
+	if (shape_plan == nullptr) {
+		shape_plan = hb_shape_plan_create_cached(hb_font_get_face(hb_font), &properties, nullptr, 0, nullptr);
+	}
+	hb_shape_plan_execute(shape_plan, hb_font, buffer, nullptr, 0);
+	const unsigned int length_in_glyphs = hb_buffer_get_length(buffer);
+	const hb_glyph_info_t* infos = hb_buffer_get_glyph_infos(buffer, nullptr);
+	const hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, nullptr);
+	std::vector<ShapedGlyph> shaped_glyphs;
+	shaped_glyphs.reserve(length_in_glyphs);
+	for (unsigned int i = 0; i < length_in_glyphs; ++i) {
+		shaped_glyphs.push_back(ShapedGlyph {infos[i].codepoint, positions[i].x_offset, positions[i].y_offset, positions[i].x_advance, positions[i].y_advance});
+	}
+	if (shaped_runs.size() == SHAPED_RUN_CACHE_SIZE) {
+		shaped_run_index.erase(shaped_runs.back().first);
+		shaped_runs.pop_back();
+	}
+	shaped_runs.emplace_front(key, std::move(shaped_glyphs));
+	shaped_run_index.emplace(std::move(key), shaped_runs.begin());
+	return shaped_runs.front().second;
 }
 hb_font_t* nitro::Font::get_hb_font() {
 	return hb_font;
@@ -122,7 +462,7 @@ float nitro::FontSet::get_descender() {
 float nitro::FontSet::get_height() {
 	return load_font(0)->get_height();
 }
-nitro::Font* nitro::FontSet::get_font(uint32_t character) {
+nitro::Font* nitro::FontSet::find_font(uint32_t character) {
 	int i = 0;
 	if (FcCharSetHasChar(char_set, character)) {
 		for (i = 0; i < font_set->nfont; ++i) {
@@ -135,63 +475,96 @@ nitro::Font* nitro::FontSet::get_font(uint32_t character) {
 	}
 	return load_font(i);
 }
+nitro::Font* nitro::FontSet::get_font(uint32_t character) {
+	if (character < 0x10000) {
+		std::unique_ptr<Font*[]>& page = bmp_pages[character >> 8];
+		if (!page) {
+			page.reset(new Font*[256]());
+		}
+		Font*& font = page[character & 0xFF];
+		if (font == nullptr) {
+			font = find_font(character);
+		}
+		return font;
+	}
+	auto iterator = supplementary_fonts.find(character);
+	if (iterator != supplementary_fonts.end()) {
+		return iterator->second;
+	}
+	Font* font = find_font(character);
+	supplementary_fonts.emplace(character, font);
+	return font;
+}
 
 // Text
-nitro::Text::Text(FontSet* font_set, const char* text, const Color& color): color(color) {
+nitro::Text::Text(FontSet* font_set, const char* text, const Color& color): color(color), glyph_bounds(0.f, 0.f, 0.f, 0.f) {
 	// TODO: handle bidirectional text
 	hb_unicode_funcs_t* funcs = hb_unicode_funcs_get_default();
+	// reused for all runs
+	static hb_buffer_t* buffer = hb_buffer_create();
+	static std::vector<uint32_t> codepoints;
+	utf8_decode(text, std::strlen(text), codepoints);
 	float x = 0.f;
 	float y = font_set->get_descender();
-	const char* text_start = text;
-	uint32_t codepoint = utf8_get_next(text);
-	hb_script_t script = hb_unicode_script(funcs, codepoint);
-	Font* font = font_set->get_font(codepoint);
-	while (codepoint) {
-		const char* text_end = text;
-		uint32_t next_codepoint = utf8_get_next(text);
-		hb_script_t next_script = hb_unicode_script(funcs, next_codepoint);
-		Font* next_font = font_set->get_font(next_codepoint);
-		if (next_codepoint == 0 || compare_scripts(next_script, script) || next_font != font) {
-			hb_buffer_t* buffer = hb_buffer_create();
-			hb_buffer_add_utf8(buffer, text_start, text_end - text_start, 0, -1);
+	std::size_t run_start = 0;
+	hb_script_t script = HB_SCRIPT_COMMON;
+	Font* font = nullptr;
+	if (!codepoints.empty()) {
+		script = hb_unicode_script(funcs, codepoints[0]);
+		font = font_set->get_font(codepoints[0]);
+	}
+	for (std::size_t i = 1; i <= codepoints.size(); ++i) {
+		hb_script_t next_script = script;
+		Font* next_font = font;
+		if (i < codepoints.size()) {
+			next_script = hb_unicode_script(funcs, codepoints[i]);
+			next_font = font_set->get_font(codepoints[i]);
+		}
+		if (i == codepoints.size() || compare_scripts(next_script, script) || next_font != font) {
+			const uint32_t* run = codepoints.data() + run_start;
+			const int run_length = i - run_start;
+			hb_buffer_clear_contents(buffer);
+			hb_buffer_add_codepoints(buffer, run, run_length, 0, run_length);
 			hb_buffer_guess_segment_properties(buffer);
-			text_start = text_end;
-			hb_shape(font->get_hb_font(), buffer, nullptr, 0);
-			const unsigned int length = hb_buffer_get_length(buffer);
-			hb_glyph_info_t* infos = hb_buffer_get_glyph_infos(buffer, nullptr);
-			hb_glyph_position_t* positions = hb_buffer_get_glyph_positions(buffer, nullptr);
-			for (unsigned int i = 0; i < length; ++i) {
-				Glyph glyph = font->render_glyph(infos[i].codepoint);
-				glyph.x = x + positions[i].x_offset / 64 + glyph.x;
-				glyph.y = y + positions[i].y_offset / 64 + glyph.y;
-				glyphs.push_back(glyph);
-				x += positions[i].x_advance / 64;
-				y += positions[i].y_advance / 64;
+			const std::vector<ShapedGlyph>& shaped_glyphs = font->shape(buffer, run, run_length);
+			run_start = i;
+			for (const ShapedGlyph& shaped_glyph: shaped_glyphs) {
+				Glyph glyph = font->render_glyph(shaped_glyph.glyph);
+				glyph.x = x + shaped_glyph.x_offset / 64 + glyph.x;
+				glyph.y = y + shaped_glyph.y_offset / 64 + glyph.y;
+				glyph_bounds = glyph_bounds | Rectangle(glyph.x, glyph.y, glyph.x + glyph.width, glyph.y + glyph.height);
+				if (glyph.texture) {
+					mesh.add(CanvasElement(glyph.x, glyph.y, glyph.x + glyph.width, glyph.y + glyph.height, Color(1.f, 1.f, 1.f), Texture(), 0.f, glyph.texture, Texture()));
+				}
+				x += shaped_glyph.x_advance / 64;
+				y += shaped_glyph.y_advance / 64;
 			}
-			hb_buffer_destroy(buffer);
 		}
-		codepoint = next_codepoint;
 		if (script_is_real(next_script)) {
 			script = next_script;
 		}
 		font = next_font;
 	}
+	mesh.prepare();
 	set_size(x, font_set->get_height());
 }
 void nitro::Text::draw(const DrawContext& draw_context) {
-	for (const Glyph& glyph: glyphs) {
-		glyph.draw(color, draw_context.projection);
-	}
+	mesh.draw(draw_context, color);
+}
+nitro::Rectangle nitro::Text::get_bounds() {
+	return Node::get_bounds() | glyph_bounds;
 }
 const nitro::Color& nitro::Text::get_color() const {
 	return color;
 }
 void nitro::Text::set_color(const Color& color) {
 	this->color = color;
+	request_redraw();
 }
 
 // TextContainer
 nitro::TextContainer::TextContainer(FontSet* font, const char* text, const Color& color, HorizontalAlignment horizontal_alignment, VerticalAlignment vertical_alignment): text(font, text, color), horizontal_alignment(horizontal_alignment), vertical_alignment(vertical_alignment) {
+	this->text.set_parent(this);
 	layout();
 }
 nitro::Node* nitro::TextContainer::get_child(std::size_t index) {
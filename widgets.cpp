@@ -35,7 +35,7 @@ void nitro::Padding::set_padding(float padding) {
 		return;
 	}
 	this->padding = padding;
-	Padding::layout();
+	request_layout();
 }
 
 // Alignment
@@ -84,7 +84,75 @@ void nitro::Alignment::set_alignment(HorizontalAlignment horizontal_alignment, V
 	}
 	this->horizontal_alignment = horizontal_alignment;
 	this->vertical_alignment = vertical_alignment;
-	layout();
+	request_layout();
+}
+
+// Layer
+// the framebuffer holds premultiplied colors, so the alpha of the layer content is accumulated separately while rendering into it
+static int layer_nesting = 0;
+static void set_blend_func() {
+	if (layer_nesting > 0) {
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	}
+	else {
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+}
+nitro::Layer::Layer(): render_list(gles2::project(1.f, 1.f)), bounds(0.f, 0.f, 0.f, 0.f), valid(false) {
+
+}
+void nitro::Layer::render() {
+	const Rectangle content = get_bounds();
+	bounds = Rectangle(floorf(content.x0), floorf(content.y0), ceilf(content.x1), ceilf(content.y1));
+	const int width = bounds.x1 - bounds.x0;
+	const int height = bounds.y1 - bounds.y0;
+	if (width <= 0 || height <= 0) {
+		framebuffer = nullptr;
+		return;
+	}
+	if (!framebuffer || framebuffer->get_width() != width || framebuffer->get_height() != height) {
+		// the depth buffer is used by the render list and by direct canvases
+		framebuffer = std::make_unique<gles2::FramebufferObject>(width, height, true);
+	}
+	GLfloat clear_color[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	framebuffer->use();
+	glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+	++layer_nesting;
+	set_blend_func();
+	const gles2::mat4 projection = gles2::project(width, height);
+	render_list.set_projection(projection);
+	Bin::draw(DrawContext(projection, Transformation(0.f, 0.f), &render_list) * Transformation(-bounds.x0, -bounds.y0));
+	render_list.flush();
+	--layer_nesting;
+	set_blend_func();
+	framebuffer->unbind();
+}
+void nitro::Layer::prepare_draw() {
+	Bin::prepare_draw();
+	if (!valid) {
+		render();
+		valid = true;
+	}
+}
+void nitro::Layer::draw(const DrawContext& draw_context) {
+	if (!framebuffer) {
+		return;
+	}
+	if (draw_context.render_list) {
+		draw_context.render_list->flush();
+	}
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	CanvasElement(bounds.x0, bounds.y0, bounds.x1, bounds.y1, Color(), Texture(framebuffer->get_texture(), Quad(0.f, 0.f, 1.f, 1.f)), 1.f, Texture(), Texture()).draw(draw_context.projection);
+	set_blend_func();
+}
+void nitro::Layer::damage(const Rectangle& rectangle) {
+	if (valid) {
+		valid = false;
+		request_prepare_draw();
+	}
+	Bin::damage(rectangle);
 }
 
 static float circle(float x) {
@@ -140,17 +208,65 @@ static nitro::Texture create_rounded_corner_texture(int radius) {
 	}
 	return nitro::Texture::create_from_data(radius, radius, 1, data.data());
 }
+static nitro::Texture create_blurred_corner_texture(int radius, int blur_radius);
+
+// Mask cache
+// masks are keyed by radius and blur radius, a blur radius of 0 is an unblurred rounded corner
+// the cache only holds weak references, a mask is freed with the last canvas using it
+static std::map<std::pair<int, int>, std::weak_ptr<gles2::Texture>> mask_cache;
+static nitro::MaskCacheStatistics mask_cache_statistics;
+static nitro::Texture get_mask(float radius, float blur_radius = 0.f) {
+	// the masks have whole pixels, so radii that round to the same size share one
+	const std::pair<int, int> key(lroundf(radius), lroundf(blur_radius));
+	auto entry = mask_cache.find(key);
+	if (entry != mask_cache.end()) {
+		if (std::shared_ptr<gles2::Texture> texture = entry->second.lock()) {
+			++mask_cache_statistics.hits;
+			return nitro::Texture(texture, nitro::Quad(0, 0, 1, 1));
+		}
+	}
+	++mask_cache_statistics.misses;
+	for (auto i = mask_cache.begin(); i != mask_cache.end();) {
+		if (i->second.expired()) {
+			i = mask_cache.erase(i);
+		}
+		else {
+			++i;
+		}
+	}
+	const nitro::Texture mask = key.second > 0 ? create_blurred_corner_texture(key.first, key.second) : create_rounded_corner_texture(key.first);
+	mask_cache[key] = mask.texture;
+	return mask;
+}
+const nitro::MaskCacheStatistics& nitro::get_mask_cache_statistics() {
+	return mask_cache_statistics;
+}
+void nitro::reset_mask_cache_statistics() {
+	mask_cache_statistics = MaskCacheStatistics {0, 0};
+}
 
 // RoundedRectangle
 nitro::RoundedRectangle::RoundedRectangle(const Color& color, float radius): color(color), radius(radius) {
 
 }
 void nitro::RoundedRectangle::draw(const DrawContext& draw_context) {
-	canvas.draw(draw_context.projection);
+	canvas.draw(draw_context);
 }
 void nitro::RoundedRectangle::layout() {
+	// the canvas only depends on the size, which it can follow without being prepared again
+	if (canvas.resize(get_width(), get_height())) {
+		return;
+	}
+	if (Shape::is_supported()) {
+		canvas.clear();
+		canvas.set_color(0.f, 0.f, get_width(), get_height(), color);
+		canvas.set_shape(0.f, 0.f, get_width(), get_height(), Shape(0.f, 0.f, get_width(), get_height(), radius));
+		canvas.prepare(get_width(), get_height(), radius);
+		return;
+	}
+	// look up the mask before the canvas releases it so that resizing reuses it
+	const Texture mask = get_mask(radius);
 	canvas.clear();
-	const Texture mask = create_rounded_corner_texture(radius);
 	const float x0 = 0.f;
 	const float y0 = 0.f;
 	const float x1 = radius;
@@ -168,7 +284,7 @@ void nitro::RoundedRectangle::layout() {
 	canvas.set_mask(x0, y0, x1, y1, mask * texcoord);
 	texcoord = texcoord.rotate();
 	canvas.set_mask(x2, y0, x3, y1, mask * texcoord);
-	canvas.prepare();
+	canvas.prepare(get_width(), get_height(), radius);
 }
 
 // RoundedBorder
@@ -176,12 +292,27 @@ nitro::RoundedBorder::RoundedBorder(float border_width, const Color& color, floa
 
 }
 void nitro::RoundedBorder::draw(const DrawContext& draw_context) {
-	canvas.draw(draw_context.projection);
+	canvas.draw(draw_context);
 }
 void nitro::RoundedBorder::layout() {
+	if (canvas.resize(get_width(), get_height())) {
+		return;
+	}
+	if (Shape::is_supported()) {
+		canvas.clear();
+		const float w = get_width();
+		const float h = get_height();
+		canvas.set_color(0.f, 0.f, w, h, color);
+		canvas.set_shape(0.f, 0.f, w, h, Shape(0.f, 0.f, w, h, radius));
+		canvas.set_inverted_shape(0.f, 0.f, w, h, Shape(border_width, border_width, w - border_width, h - border_width, radius - border_width));
+		canvas.prepare(get_width(), get_height(), std::max(radius, border_width));
+		return;
+	}
+	const Texture outer_mask = get_mask(radius);
+	const Texture inner_mask = get_mask(radius - border_width);
 	canvas.clear();
 	{
-		const Texture mask = create_rounded_corner_texture(radius);
+		const Texture& mask = outer_mask;
 		const float x0 = 0.f;
 		const float y0 = 0.f;
 		const float x1 = radius;
@@ -201,7 +332,7 @@ void nitro::RoundedBorder::layout() {
 		canvas.set_mask(x2, y0, x3, y1, mask * texcoord);
 	}
 	{
-		const Texture mask = create_rounded_corner_texture(radius - border_width);
+		const Texture& mask = inner_mask;
 		const float x0 = border_width;
 		const float y0 = border_width;
 		const float x1 = radius;
@@ -221,46 +352,9 @@ void nitro::RoundedBorder::layout() {
 		texcoord = texcoord.rotate();
 		canvas.set_inverted_mask(x2, y0, x3, y1, mask * texcoord);
 	}
-	canvas.prepare();
+	canvas.prepare(get_width(), get_height(), std::max(radius, border_width));
 }
 
-static std::vector<float> create_gaussian_kernel(int radius) {
-	std::vector<float> kernel(radius * 2 + 1);
-	const float sigma = radius / 3.f;
-	const float factor = 1.f / sqrtf(2.f * M_PI * sigma*sigma);
-	for (unsigned int i = 0; i < kernel.size(); ++i) {
-		const float x = (int)i - radius;
-		kernel[i] = factor * expf(-x*x/(2.f*sigma*sigma));
-	}
-	return kernel;
-}
-constexpr int clamp(int value, int min, int max) {
-	return value < min ? min : (max < value ? max : value);
-}
-static void blur(int radius, std::vector<unsigned char>& buffer, int w, int h) {
-	const std::vector<float> kernel = create_gaussian_kernel(radius);
-	std::vector<unsigned char> tmp(buffer.size());
-	for (int y = 0; y < h; ++y) {
-		for (int x = 0; x < w; ++x) {
-			float sum = 0.f;
-			for (int k = 0; k < radius * 2 + 1; ++k) {
-				const int kx = clamp(x + k - radius, 0, w - 1);
-				sum += buffer[y * w + kx] * kernel[k];
-			}
-			tmp[y * w + x] = sum + 0.5f;
-		}
-	}
-	for (int y = 0; y < h; ++y) {
-		for (int x = 0; x < w; ++x) {
-			float sum = 0.f;
-			for (int k = 0; k < radius * 2 + 1; ++k) {
-				const int ky = clamp(y + k - radius, 0, h - 1);
-				sum += tmp[ky * w + x] * kernel[k];
-			}
-			buffer[y * w + x] = sum + 0.5f;
-		}
-	}
-}
 static nitro::Texture create_blurred_corner_texture(int radius, int blur_radius) {
 	const int size = radius + blur_radius * 2;
 	std::vector<unsigned char> buffer(size * size);
@@ -280,7 +374,7 @@ static nitro::Texture create_blurred_corner_texture(int radius, int blur_radius)
 			}
 		}
 	}
-	blur(blur_radius, buffer, size, size);
+	nitro::blur(buffer.data(), size, size, blur_radius);
 	return nitro::Texture::create_from_data(size, size, 1, buffer.data());
 }
 
@@ -289,12 +383,55 @@ nitro::Shadow::Shadow(const Color& color, float radius, float blur_radius, float
 
 }
 void nitro::Shadow::draw(const DrawContext& draw_context) {
-	canvas.draw(draw_context.projection);
+	canvas.draw(draw_context);
 }
 void nitro::Shadow::layout() {
+	if (canvas.resize(get_width(), get_height())) {
+		return;
+	}
+	if (Shape::is_supported()) {
+		canvas.clear();
+		{
+			const Shape shape(x_offset, y_offset, get_width() + x_offset, get_height() + y_offset, radius, blur_radius / 3.f);
+			const float x0 = -blur_radius + x_offset;
+			const float y0 = -blur_radius + y_offset;
+			const float x1 = radius + blur_radius + x_offset;
+			const float y1 = radius + blur_radius + y_offset;
+			const float x2 = get_width() - (radius + blur_radius) + x_offset;
+			const float y2 = get_height() - (radius + blur_radius) + y_offset;
+			const float x3 = get_width() + blur_radius + x_offset;
+			const float y3 = get_height() + blur_radius + y_offset;
+			canvas.set_color(x0, y0, x3, y3, color);
+			canvas.set_shape(x0, y0, x3, y1, shape);
+			canvas.set_shape(x0, y2, x3, y3, shape);
+			canvas.set_shape(x0, y1, x1, y2, shape);
+			canvas.set_shape(x2, y1, x3, y2, shape);
+		}
+		{
+			const Shape shape(0.f, 0.f, get_width(), get_height(), radius);
+			const float x0 = 0.f;
+			const float y0 = 0.f;
+			const float x1 = radius;
+			const float y1 = radius;
+			const float x2 = get_width() - radius;
+			const float y2 = get_height() - radius;
+			const float x3 = get_width();
+			const float y3 = get_height();
+			canvas.set_color(x1, y0, x2, y3, Color());
+			canvas.set_color(x0, y1, x3, y2, Color());
+			canvas.set_inverted_shape(x2, y2, x3, y3, shape);
+			canvas.set_inverted_shape(x0, y2, x1, y3, shape);
+			canvas.set_inverted_shape(x0, y0, x1, y1, shape);
+			canvas.set_inverted_shape(x2, y0, x3, y1, shape);
+		}
+		canvas.prepare(get_width(), get_height(), radius + blur_radius + std::max(fabsf(x_offset), fabsf(y_offset)));
+		return;
+	}
+	const Texture blurred_mask = get_mask(radius, blur_radius);
+	const Texture rounded_mask = get_mask(radius);
 	canvas.clear();
 	{
-		const Texture mask = create_blurred_corner_texture(radius, blur_radius);
+		const Texture& mask = blurred_mask;
 		const float x0 = -blur_radius + x_offset;
 		const float y0 = -blur_radius + y_offset;
 		const float x1 = radius + blur_radius + x_offset;
@@ -326,7 +463,7 @@ void nitro::Shadow::layout() {
 		}
 	}
 	{
-		const Texture mask = create_rounded_corner_texture(radius);
+		const Texture& mask = rounded_mask;
 		const float x0 = 0.f;
 		const float y0 = 0.f;
 		const float x1 = radius;
@@ -346,7 +483,11 @@ void nitro::Shadow::layout() {
 		texcoord = texcoord.rotate();
 		canvas.set_inverted_mask(x2, y0, x3, y1, mask * texcoord);
 	}
-	canvas.prepare();
+	canvas.prepare(get_width(), get_height(), radius + blur_radius + std::max(fabsf(x_offset), fabsf(y_offset)));
+}
+nitro::Rectangle nitro::Shadow::get_bounds() {
+	const Rectangle shadow(-blur_radius + x_offset, -blur_radius + y_offset, get_width() + blur_radius + x_offset, get_height() + blur_radius + y_offset);
+	return Node::get_bounds() | shadow;
 }
 
 // InsetShadow
@@ -354,12 +495,40 @@ nitro::InsetShadow::InsetShadow(const Color& color, float radius, float blur_rad
 
 }
 void nitro::InsetShadow::draw(const DrawContext& draw_context) {
-	canvas.draw(draw_context.projection);
+	canvas.draw(draw_context);
 }
 void nitro::InsetShadow::layout() {
+	if (canvas.resize(get_width(), get_height())) {
+		return;
+	}
+	if (Shape::is_supported()) {
+		canvas.clear();
+		const float w = get_width();
+		const float h = get_height();
+		canvas.set_color(0.f, 0.f, w, h, color);
+		canvas.set_shape(0.f, 0.f, w, h, Shape(0.f, 0.f, w, h, radius));
+		const Shape shape(x_offset, y_offset, w + x_offset, h + y_offset, radius, blur_radius / 3.f);
+		const float x0 = -blur_radius + x_offset;
+		const float y0 = -blur_radius + y_offset;
+		const float x1 = radius + blur_radius + x_offset;
+		const float y1 = radius + blur_radius + y_offset;
+		const float x2 = w - (radius + blur_radius) + x_offset;
+		const float y2 = h - (radius + blur_radius) + y_offset;
+		const float x3 = w + blur_radius + x_offset;
+		const float y3 = h + blur_radius + y_offset;
+		canvas.set_color(x1, y1, x2, y2, Color());
+		canvas.set_inverted_shape(x0, y0, x3, y1, shape);
+		canvas.set_inverted_shape(x0, y2, x3, y3, shape);
+		canvas.set_inverted_shape(x0, y1, x1, y2, shape);
+		canvas.set_inverted_shape(x2, y1, x3, y2, shape);
+		canvas.prepare(get_width(), get_height(), radius + blur_radius + std::max(fabsf(x_offset), fabsf(y_offset)));
+		return;
+	}
+	const Texture rounded_mask = get_mask(radius);
+	const Texture blurred_mask = get_mask(radius, blur_radius);
 	canvas.clear();
 	{
-		const Texture mask = create_rounded_corner_texture(radius);
+		const Texture& mask = rounded_mask;
 		const float x0 = 0.f;
 		const float y0 = 0.f;
 		const float x1 = radius;
@@ -379,7 +548,7 @@ void nitro::InsetShadow::layout() {
 		canvas.set_mask(x2, y0, x3, y1, mask * texcoord);
 	}
 	{
-		const Texture mask = create_blurred_corner_texture(radius, blur_radius);
+		const Texture& mask = blurred_mask;
 		const float x0 = -blur_radius + x_offset;
 		const float y0 = -blur_radius + y_offset;
 		const float x1 = radius + blur_radius + x_offset;
@@ -410,5 +579,5 @@ void nitro::InsetShadow::layout() {
 			canvas.set_inverted_mask(x2, y1, x3, y2, mask * texcoord);
 		}
 	}
-	canvas.prepare();
+	canvas.prepare(get_width(), get_height(), radius + blur_radius + std::max(fabsf(x_offset), fabsf(y_offset)));
 }
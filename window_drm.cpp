@@ -106,6 +106,7 @@ nitro::WindowDRM::WindowDRM(int width, int height, const char* title): Window(wi
 		EGL_GREEN_SIZE, 1,
 		EGL_BLUE_SIZE, 1,
 		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 16,
 		//EGL_SAMPLE_BUFFERS, 1,
 		//EGL_SAMPLES, 4,
 	EGL_NONE};
@@ -118,8 +119,15 @@ nitro::WindowDRM::WindowDRM(int width, int height, const char* title): Window(wi
 	// EGL context and surface
 	//eglBindAPI(EGL_OPENGL_API);
 	//constexpr EGLint context_attribs[] = {EGL_NONE};
-	constexpr EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
-	EGLContext context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	// prefer GLES 3 and fall back to GLES 2
+	EGLContext context = EGL_NO_CONTEXT;
+	for (EGLint version: {3, 2}) {
+		const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, version, EGL_NONE};
+		context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+		if (context != EGL_NO_CONTEXT) {
+			break;
+		}
+	}
 	if (context == EGL_NO_CONTEXT) {
 		fprintf(stderr, "eglCreateContext error\n");
 	}
@@ -134,15 +142,43 @@ nitro::WindowDRM::WindowDRM(int width, int height, const char* title): Window(wi
 	//glEnable(GL_FRAMEBUFFER_SRGB);
 	//glEnable(0x809D); // GL_MULTISAMPLE
 
+	Canvas::load_programs();
+
 	set_size(mode_info.hdisplay, mode_info.vdisplay);
 }
 
 void nitro::WindowDRM::draw(const DrawContext& draw_context) {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	static const bool buffer_age = epoxy_has_egl_extension(egl_display, "EGL_EXT_buffer_age");
+	static const bool partial_update = epoxy_has_egl_extension(egl_display, "EGL_KHR_partial_update");
+	static const bool swap_buffers_with_damage = epoxy_has_egl_extension(egl_display, "EGL_KHR_swap_buffers_with_damage");
+	// without knowing the age of the back buffer everything has to be repainted
+	EGLint age = 0;
+	if (buffer_age || partial_update) {
+		eglQuerySurface(egl_display, surface, EGL_BUFFER_AGE_EXT, &age);
+	}
+	const Rectangle region = get_repaint_region(age);
+	EGLint rectangle[] = {EGLint(region.x0), EGLint(region.y0), EGLint(region.x1 - region.x0), EGLint(region.y1 - region.y0)};
+	if (partial_update) {
+		eglSetDamageRegionKHR(egl_display, surface, rectangle, 1);
+	}
+	gles2::StateCache::bind_framebuffer(0);
 	glViewport(0, 0, get_width(), get_height());
+	glScissor(rectangle[0], rectangle[1], rectangle[2], rectangle[3]);
+	glEnable(GL_SCISSOR_TEST);
 	glClear(GL_COLOR_BUFFER_BIT);
-	Bin::draw(draw_context);
-	eglSwapBuffers(egl_display, surface);
+	Bin::draw(draw_context.clip(region));
+	if (draw_context.render_list) {
+		draw_context.render_list->flush();
+	}
+	glDisable(GL_SCISSOR_TEST);
+	if (swap_buffers_with_damage) {
+		const Rectangle damage = get_damage();
+		EGLint damage_rectangle[] = {EGLint(damage.x0), EGLint(damage.y0), EGLint(damage.x1 - damage.x0), EGLint(damage.y1 - damage.y0)};
+		eglSwapBuffersWithDamageKHR(egl_display, surface, damage_rectangle, 1);
+	}
+	else {
+		eglSwapBuffers(egl_display, surface);
+	}
 	gbm_bo* bo = gbm_surface_lock_front_buffer(gbm_surface);
 	uint32_t handle = gbm_bo_get_handle(bo).u32;
 	uint32_t pitch = gbm_bo_get_stride(bo);